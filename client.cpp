@@ -11,8 +11,11 @@
 #include <errno.h>
 #include <unistd.h>
 #include <poll.h>
+#include <time.h>
 #include <iterator>
 #include <map>
+#include <deque>
+#include <vector>
 
 #include <iostream>
 #include <sstream>
@@ -21,13 +24,13 @@
 #include <chrono>
 #include <string>
 #include <climits>
+#include <iomanip>
+
+#include "confundo.h"
 
 using namespace std;
 
 const int NUMBER_OF_ARGS = 3;
-const int DATA_SIZE = 512;
-const int HEADER_SIZE = 12;
-const int PACKET_SIZE = HEADER_SIZE + DATA_SIZE;
 
 const int NUM_MASK1 = 0xff000000;
 const int NUM_MASK2 = 0x00ff0000;
@@ -38,84 +41,56 @@ const int NUM_RIGHT_OFFSET2=16;
 const int NUM_RIGHT_OFFSET3=8;
 const long CONN_MASK =0xffff0000;
 const int CONN_RIGHT_OFFSET = 16;
-const int ACK_MASK = 4;
-const int ACK_OFFSET = 2;
-const int SYN_MASK = 2;
-const int SYN_OFFSET = 1;
-const int FIN_MASK = 1;
-const int FLAG_POS = 11;
-
-struct Header
-{
-  uint32_t sequenceNumber;
-  uint32_t acknowledgementNumber;
-  uint16_t connectionID;
-  bool ACKflag;
-  bool SYNflag;
-  bool FINflag;
-};
 
-// struct Packet
-// {
-//   char* payload;
-//   chrono::time_point<chrono::system_clock> timeLastSent;
-// };
+const int RTO_MSECS = 500;
+const int MAX_RTO_MSECS = 4000;
+const int MAX_PROBE_MSECS = 4000;
+const int NO_RESPONSE_SECONDS = 10;
+// a compressed block is only sent if it saves at least 1/8 of the raw size
+const int COMPRESS_MIN_SAVING_SHIFT = 3;
 
-int32_t getFlags(bool ACKflag, bool SYNflag, bool FINflag)
+// a data segment kept until the server ACKs it
+struct Segment
 {
-  return ((ACKflag<<ACK_OFFSET))|((SYNflag<<SYN_OFFSET))|(FINflag);
-}
+  uint32_t seq;
+  vector<char> payload;
+};
 
-// returns a 96 bit(12 byte) array representing the TCP header
-void convertHeaderToByteArray(Header h, char header[HEADER_SIZE])
+// The file as the sliding window sees it. With compression the file is read a
+// block at a time and segments are cut from the framed blocks instead.
+struct FileSource
 {
-  memset(&header[0], 0, HEADER_SIZE);
-  uint32_t seqNetwork = htonl(h.sequenceNumber);
-  uint32_t ackNetwork = (htonl(h.acknowledgementNumber));
-  //an int representing the third 'row' of the header
-  uint16_t connNetwork = htons(h.connectionID);
-  uint16_t ASFNetwork = htons(getFlags(h.ACKflag,h.SYNflag,h.FINflag));
-  memcpy(header, (char *)&seqNetwork, sizeof(uint32_t));
-  memcpy(header+4, (char *)&ackNetwork, sizeof(uint32_t));
-  memcpy(header+8, (char *)&connNetwork, sizeof(uint16_t));
-  memcpy(header+10, (char *)&ASFNetwork, sizeof(uint16_t));
-}
+  fstream file;
+  bool compress;
+  vector<char> frame;     // current block, header included
+  size_t framePos;        // bytes of it already handed out
+  int blocks;
+  uint64_t rawBytes;
+  uint64_t storedBytes;
+  double cpuSeconds;      // spent compressing
+};
 
 uint32_t getValueFromBytes(char *h, int index)
 {
   return ntohl(((h[index])<<NUM_RIGHT_OFFSET1)|((h[index+1])<<NUM_RIGHT_OFFSET2)|((h[index+2])<<NUM_RIGHT_OFFSET3)|(h[index+3]));
 }
 
-Header convertByteArrayToHeader(char *h)
-{
-  Header res;
-  res.ACKflag = h[FLAG_POS]&ACK_MASK;
-  res.SYNflag = h[FLAG_POS]&SYN_MASK;
-  res.FINflag = h[FLAG_POS]&FIN_MASK;
-
-  memcpy(&res.sequenceNumber, (uint32_t *)h, sizeof(uint32_t));
-  memcpy(&res.acknowledgementNumber, (uint32_t *)&h[4], sizeof(uint32_t));
-  memcpy(&res.connectionID, (uint16_t *)&h[8], sizeof(uint16_t));
-
-  res.acknowledgementNumber = ntohl(res.acknowledgementNumber);
-  res.connectionID = ntohs(res.connectionID);
-  res.sequenceNumber = ntohl(res.sequenceNumber);
-
-  return res;
-}
-
 struct Arguments
 {
   int port;
   string host;
   string filename;
+  int mss;
+  string resumeToken;
+  bool crc;
+  bool compress;
 };
 
 enum msgType{RECV,SEND,DROP};
 
 void printUsage()
 {
-  cerr<< "USAGE: ./client <HOSTNAME-OR-IP> <PORT> <FILENAME>\n";
+  cerr<< "USAGE: ./client [-c] [-z] [-m MSS] [-r RESUME-TOKEN] <HOSTNAME-OR-IP> <PORT> <FILENAME>\n";
 }
 
 void printError(string message)
@@ -138,6 +113,7 @@ Header createFIN(Header ack)
   FIN.ACKflag = 0;
   FIN.SYNflag = 0;
   FIN.FINflag = 1;
+  FIN.OPTflag = 0;
   FIN.sequenceNumber = ack.acknowledgementNumber;
 
   return FIN;
@@ -202,29 +178,127 @@ Header createFinalACK(Header ack)
   h.acknowledgementNumber = ack.sequenceNumber+1;
   h.sequenceNumber = ack.acknowledgementNumber;
   h.FINflag = 0;
+  h.OPTflag = 0;
   h.SYNflag = 0;
   h.connectionID = ack.connectionID;
   return h;
 }
 
-void updateWindow(uint32_t &cwnd, uint32_t &ssthresh){
+void updateWindow(uint32_t &cwnd, uint32_t &ssthresh, uint32_t mss){
   if (cwnd < ssthresh)
   {
-    cwnd += 512;
+    cwnd += mss;
   }
   else  /*  cwnd >= ssthresh  */
   {
-    cwnd += (512*512)/cwnd;
+    cwnd += (mss*mss)/cwnd;
   }
+  cwnd = min(cwnd, (uint32_t)MAX_CWND);
   //cout << "\ncwnd: "<<cwnd<<" | ssthresh: " <<ssthresh<<endl;
 }
 
-void communicate(const int sockfd, const string filename, struct sockaddr_in serverAddr)
+void sendSegment(const int sockfd, struct sockaddr_in serverAddr, uint16_t connexID, const Segment &segment, uint32_t cwnd, uint32_t ssthresh, bool dup, bool useCRC)
+{
+  Header payloadHeader;
+  payloadHeader.sequenceNumber = segment.seq;
+  payloadHeader.acknowledgementNumber = 0;
+  payloadHeader.connectionID = connexID;
+  payloadHeader.ACKflag = 0;
+  payloadHeader.SYNflag = 0;
+  payloadHeader.FINflag = 0;
+  payloadHeader.OPTflag = 0;
+
+  char msgSend[MAX_PACKET_SIZE];
+  int size = buildPacket(payloadHeader, noOptions(), segment.payload.data(), segment.payload.size(), msgSend);
+  if (useCRC)
+    size = appendTrailer(msgSend, size);
+  if (sendto(sockfd, msgSend, size, 0, (const sockaddr *)&serverAddr, sizeof(serverAddr)) == -1)
+  {
+    printError("Unable to send data to server");
+    exitOnError(sockfd);
+  }
+  printPacketDetails(payloadHeader, SEND, cwnd, ssthresh, dup);
+}
+
+double threadCPUSeconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+// Reads the next block of the file and frames it, compressed if that saves
+// enough. Reports the block's ratio and CPU cost on stderr. Returns false at
+// the end of the file.
+bool nextBlock(FileSource &source)
+{
+  char raw[COMPRESS_BLOCK_SIZE];
+  source.file.read(raw, COMPRESS_BLOCK_SIZE);
+  int rawLen = source.file.gcount();
+  if (rawLen == 0)
+    return false;
+
+  source.frame.resize(BLOCK_HEADER_SIZE+rawLen);
+  double cpuStart = threadCPUSeconds();
+  int storedLen = lzCompress(raw, rawLen, source.frame.data()+BLOCK_HEADER_SIZE, rawLen-(rawLen>>COMPRESS_MIN_SAVING_SHIFT));
+  double cpu = threadCPUSeconds()-cpuStart;
+  bool compressed = storedLen > 0;
+  if (!compressed)
+  {
+    storedLen = rawLen;
+    memcpy(source.frame.data()+BLOCK_HEADER_SIZE, raw, rawLen);
+  }
+  putBlockHeader(source.frame.data(), rawLen, storedLen, compressed);
+  source.frame.resize(BLOCK_HEADER_SIZE+storedLen);
+  source.framePos = 0;
+
+  source.blocks++;
+  source.rawBytes += rawLen;
+  source.storedBytes += BLOCK_HEADER_SIZE+storedLen;
+  source.cpuSeconds += cpu;
+  cerr << "BLOCK " << source.blocks << " " << rawLen << " " << storedLen << " "
+       << fixed << setprecision(3) << (double)rawLen/storedLen << " "
+       << (long)(cpu*1e6) << "us " << (compressed ? "LZ77" : "STORED") << endl;
+  return true;
+}
+
+// fills buf with up to size bytes of the (possibly compressed) stream;
+// returns 0 at the end of the file
+int readSource(FileSource &source, char *buf, int size)
+{
+  if (!source.compress)
+  {
+    source.file.read(buf, size);
+    return source.file.gcount();
+  }
+  if (source.framePos == source.frame.size() && !nextBlock(source))
+    return 0;
+  int n = min((size_t)size, source.frame.size()-source.framePos);
+  memcpy(buf, source.frame.data()+source.framePos, n);
+  source.framePos += n;
+  return n;
+}
+
+// 64-bit FNV-1a, turns the resume token given on the command line into the
+// one sent to the server
+uint64_t hashToken(const string &token)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (unsigned char c : token)
+  {
+    hash ^= c;
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+void communicate(const int sockfd, struct sockaddr_in serverAddr, const Arguments &args)
 {
   //------------ SYN Handshaking ------------//
 
   uint16_t connexID = 0;
-  uint32_t cwnd = 512;
+  uint32_t mss = DATA_SIZE;
+  uint32_t cwnd = mss;
   uint32_t ssthresh = 10000;
 
   Header clientSYN;
@@ -234,13 +308,26 @@ void communicate(const int sockfd, const string filename, struct sockaddr_in ser
   clientSYN.ACKflag = 0;
   clientSYN.SYNflag = 1;
   clientSYN.FINflag = 0;
+  clientSYN.OPTflag = 1;
+
+  Options clientSYNOptions = noOptions();
+  clientSYNOptions.mss = args.mss;
+  clientSYNOptions.hasRwnd = true;
+  clientSYNOptions.hasCRC = args.crc;
+  clientSYNOptions.hasCompress = args.compress;
+  if (!args.resumeToken.empty())
+  {
+    clientSYNOptions.hasResume = true;
+    clientSYNOptions.resumeToken = hashToken(args.resumeToken);
+  }
 
-  char c_SYN[HEADER_SIZE] = {0}; //holds SYN to send to server
-  convertHeaderToByteArray(clientSYN, c_SYN);
+  char c_SYN[HEADER_SIZE+MAX_OPTIONS_SIZE] = {0}; //holds SYN to send to server
+  int synSize = buildPacket(clientSYN, clientSYNOptions, nullptr, 0, c_SYN);
 
   int rec_res = 0;
-  char c_SYNACK[HEADER_SIZE] = {0}; // holds SYN ACK received from server
+  char c_SYNACK[HEADER_SIZE+MAX_OPTIONS_SIZE] = {0}; // holds SYN ACK received from server
   Header serverSYNACK;
+  Options serverSYNACKOptions;
 
   socklen_t serverAddrLen = sizeof(serverAddr);
 
@@ -256,7 +343,7 @@ void communicate(const int sockfd, const string filename, struct sockaddr_in ser
   while (!receivedSYNACK)
   {
     //--- Send SYN ---//
-    if (sendto(sockfd, c_SYN, HEADER_SIZE, 0, (const sockaddr *)&serverAddr, sizeof(serverAddr)) == -1)
+    if (sendto(sockfd, c_SYN, synSize, 0, (const sockaddr *)&serverAddr, sizeof(serverAddr)) == -1)
     {
       printError("Unable to send SYN header to server");
       exitOnError(sockfd);
@@ -267,19 +354,22 @@ void communicate(const int sockfd, const string filename, struct sockaddr_in ser
     poll(&fds, 1, timeout_msecs);
     if (fds.revents != 0)         // An event on sockfd has occurred.
     {
-      rec_res = recvfrom(sockfd, c_SYNACK, HEADER_SIZE, 0, (struct sockaddr *)&serverAddr,&serverAddrLen);
+      rec_res = recvfrom(sockfd, c_SYNACK, sizeof(c_SYNACK), 0, (struct sockaddr *)&serverAddr,&serverAddrLen);
       if (rec_res == -1)
       {
         printError("Error in receiving SYN ACK from server");
         exitOnError(sockfd);
       }
-      if(rec_res > 0)
+      if(rec_res > 0 && parsePacket(c_SYNACK, rec_res, serverSYNACK, serverSYNACKOptions) >= 0)
       {
-          serverSYNACK = convertByteArrayToHeader(c_SYNACK);
           if (serverSYNACK.ACKflag && serverSYNACK.SYNflag && !serverSYNACK.FINflag)
           {
               receivedSYNACK = true;
               connexID = serverSYNACK.connectionID;
+              // a server that ignores the option keeps the default MSS
+              if (serverSYNACKOptions.mss)
+                mss = serverSYNACKOptions.mss;
+              cwnd = mss;
               printPacketDetails(serverSYNACK, RECV, cwnd, ssthresh);
               break;
           }
@@ -298,11 +388,17 @@ void communicate(const int sockfd, const string filename, struct sockaddr_in ser
   clientSYNACK_ACK.ACKflag = 1;
   clientSYNACK_ACK.SYNflag = 0;
   clientSYNACK_ACK.FINflag = 0;
+  // the server keeps no state until this ACK, so echo the options it granted
+  clientSYNACK_ACK.OPTflag = serverSYNACK.OPTflag;
 
-  char c_SYNACK_ACK[HEADER_SIZE] = {0}; //holds SYN to send to server
-  convertHeaderToByteArray(clientSYNACK_ACK, c_SYNACK_ACK);
+  char c_SYNACK_ACK[HEADER_SIZE+MAX_OPTIONS_SIZE+CRC_SIZE] = {0}; //holds SYN to send to server
+  int synAckAckSize = buildPacket(clientSYNACK_ACK, serverSYNACKOptions, nullptr, 0, c_SYNACK_ACK);
+  // every packet from here on carries a trailer if the server agreed to it
+  bool useCRC = serverSYNACKOptions.hasCRC;
+  if (useCRC)
+    synAckAckSize = appendTrailer(c_SYNACK_ACK, synAckAckSize);
 
-  if (sendto(sockfd, c_SYNACK_ACK, HEADER_SIZE, 0, (const sockaddr *)&serverAddr, sizeof(serverAddr)) == -1)
+  if (sendto(sockfd, c_SYNACK_ACK, synAckAckSize, 0, (const sockaddr *)&serverAddr, sizeof(serverAddr)) == -1)
   {
     printError("Unable to send ACK for SYN ACK to server");
     exitOnError(sockfd);
@@ -312,124 +408,225 @@ void communicate(const int sockfd, const string filename, struct sockaddr_in ser
   //-----------------------------------------// End of SYN Handshaking
 
   // send/receive data to/from connection
-  fstream fin;
-  fin.open(filename, ios::in);
-  char buf[PACKET_SIZE] = {0};
-
-  char c_serverACK[HEADER_SIZE] = {0};
-  Header serverACK;
-
-  char c_clientPayloadHeader[HEADER_SIZE] = {0};
-  Header clientPayloadHeader;
-
-  uint32_t seqNum = 12345; //TODO
-  uint32_t ackNum = 0; //TODO
-
-  //------Map--------//
-  // map<int, Packet> payload_map;
-  // vector<int> unACKed;
-  //
-  // Packet packet;
-
-  //--------- Polling for payloads ---------//
-  struct pollfd fds_socket;
-  timeout_msecs = 500;
-
-  fds_socket.fd = sockfd; //waiting for ACKS
-  fds_socket.events = POLLIN;
-
-  //receiving
-  Header ack = serverSYNACK;
-  char ackArray[HEADER_SIZE];
+  FileSource source;
+  source.file.open(args.filename, ios::in);
+  source.compress = serverSYNACKOptions.hasCompress;
+  source.framePos = 0;
+  source.blocks = 0;
+  source.rawBytes = 0;
+  source.storedBytes = 0;
+  source.cpuSeconds = 0;
+  char buf[MAX_DATA_SIZE] = {0};
+  // the server already has everything before this offset
+  if (serverSYNACKOptions.hasResume)
+    source.file.seekg(serverSYNACKOptions.resumeOffset);
+
+  //--------- Sliding window ---------//
+  deque<Segment> unACKed;           // oldest first
+  size_t sentCount = 0;             // unACKed segments sent since the last timeout
+  uint32_t bytesInFlight = 0;       // payload bytes of those segments
+  uint32_t unACKedBytes = 0;
+  uint32_t nextSeq = serverSYNACK.acknowledgementNumber;
+  // without the option the server never limits us
+  uint32_t rwnd = serverSYNACKOptions.hasRwnd ? serverSYNACKOptions.rwnd : UINT32_MAX;
+  bool fileDone = false;
+  uint32_t fileDigest = 0;          // CRC32C of every new payload byte sent
+  int rto_msecs = RTO_MSECS;
+  int probe_msecs = RTO_MSECS;
+
+  Header ack = serverSYNACK;        // last ACK that moved the window
+  char ackArray[HEADER_SIZE+MAX_OPTIONS_SIZE];
   auto start = chrono::system_clock::now();
   auto end = chrono::system_clock::now();
+  auto timerExpiry = chrono::steady_clock::now() + chrono::milliseconds(rto_msecs);
 
-  while ((chrono::duration_cast<chrono::seconds>(end - start).count() < 10))
+  while ((chrono::duration_cast<chrono::seconds>(end - start).count() < NO_RESPONSE_SECONDS))
   {
-    end = chrono::system_clock::now();
-    if (seqNum > 102400) //Max sequenceNumber, reset
-      seqNum = seqNum % (102401);
-    if (ackNum > 102400) //Max acknowledgementNumber, reset
-      ackNum = ackNum % (102401);
-
-    fin.read(buf, DATA_SIZE);
-
-    //sending
-    char msgHeader[HEADER_SIZE];
-    char msgSend[HEADER_SIZE+fin.gcount()];
-
-    Header payloadHeader;
-    payloadHeader.sequenceNumber = ack.acknowledgementNumber;
-    payloadHeader.acknowledgementNumber = 0;
-    payloadHeader.connectionID = connexID;
-    payloadHeader.ACKflag = 0;
-    payloadHeader.SYNflag = 0;
-    payloadHeader.FINflag = 0;
-
-    //Check size of payload
-    //if 0, break
-    if(fin.gcount() == 0){
-      break;
-    }
-    //if not, create a reponse packet
-    convertHeaderToByteArray(payloadHeader, msgHeader);
-    //appending header and payload to packet to send
-    memcpy(msgSend,msgHeader,HEADER_SIZE);
-    memcpy(msgSend+12,buf,fin.gcount());
-    //send response packet
-    if (sendto(sockfd, msgSend, HEADER_SIZE+fin.gcount(), 0, (const sockaddr *)&serverAddr, sizeof(serverAddr)) == -1)
+    //--- fill min(cwnd, rwnd), retransmissions first ---//
+    while (true)
     {
-      printError("Unable to send data to server");
-      exitOnError(sockfd);
+      uint32_t window = min(cwnd, rwnd);
+      uint32_t sendable = window > bytesInFlight ? window - bytesInFlight : 0;
+
+      if (sentCount < unACKed.size())
+      {
+        Segment &segment = unACKed[sentCount];
+        if (segment.payload.size() > sendable)
+          break;
+        sendSegment(sockfd, serverAddr, connexID, segment, cwnd, ssthresh, true, useCRC);
+        bytesInFlight += segment.payload.size();
+        sentCount++;
+        continue;
+      }
+      if (fileDone)
+        break;
+
+      // only send less than a full segment when the peer cannot take more
+      uint32_t size = min(sendable, mss);
+      if (size == 0 || (size < mss && bytesInFlight > 0))
+        break;
+
+      int n = readSource(source, buf, size);
+      if (n == 0)
+      {
+        fileDone = true;
+        break;
+      }
+      Segment segment;
+      segment.seq = nextSeq;
+      segment.payload.assign(buf, buf+n);
+      fileDigest = crc32c(fileDigest, buf, n);
+      sendSegment(sockfd, serverAddr, connexID, segment, cwnd, ssthresh, false, useCRC);
+      if (unACKed.empty())
+        timerExpiry = chrono::steady_clock::now() + chrono::milliseconds(rto_msecs);
+      nextSeq = (nextSeq + n) % (MAX_SEQACK+1);
+      bytesInFlight += n;
+      unACKedBytes += n;
+      unACKed.push_back(segment);
+      sentCount++;
     }
-    printPacketDetails(payloadHeader, SEND, cwnd, ssthresh);
 
-    // packet.payload = msgSend;
-    // packet.timeLastSent = chrono::system_clock::now();
-    // payload_map[ack.acknowledgementNumber] = packet;
+    if (fileDone && unACKed.empty())
+      break;
 
-    //receive the ack for the response packet
-    poll(&fds, 1, timeout_msecs);
+    //--- wait for an ACK or the timer ---//
+    end = chrono::system_clock::now();
+    int wait_msecs = chrono::duration_cast<chrono::milliseconds>(timerExpiry - chrono::steady_clock::now()).count();
+    poll(&fds, 1, max(wait_msecs, 0));
     if (fds.revents != 0)         // An event on sockfd has occurred.
     {
-      rec_res = recvfrom(sockfd, ackArray, HEADER_SIZE, 0, (struct sockaddr *)&serverAddr,&serverAddrLen);
+      rec_res = recvfrom(sockfd, ackArray, sizeof(ackArray), 0, (struct sockaddr *)&serverAddr,&serverAddrLen);
       if (rec_res == -1)
       {
-        printError("Error in receiving SYN ACK from server");
+        printError("Error in receiving ACK from server");
         exitOnError(sockfd);
       }
-      if(rec_res > 0)
+      Header serverACK;
+      Options serverACKOptions;
+      if (rec_res > 0 && parsePacket(ackArray, rec_res, serverACK, serverACKOptions) >= 0)
       {
         start = chrono::system_clock::now();
-        ack = convertByteArrayToHeader(ackArray);
-        printPacketDetails(ack, RECV, cwnd, ssthresh);
-        updateWindow(cwnd, ssthresh);
+        printPacketDetails(serverACK, RECV, cwnd, ssthresh);
+        if (serverACKOptions.hasRwnd)
+        {
+          if (rwnd == 0 && serverACKOptions.rwnd > 0)
+            timerExpiry = chrono::steady_clock::now() + chrono::milliseconds(rto_msecs);
+          rwnd = serverACKOptions.rwnd;
+        }
+
+        uint32_t acked = unACKed.empty() ? 0 : (serverACK.acknowledgementNumber + MAX_SEQACK+1 - unACKed.front().seq) % (MAX_SEQACK+1);
+        if (acked > 0 && acked <= unACKedBytes)
+        {
+          // cumulative ACK: drop every segment it covers
+          while (!unACKed.empty() && acked >= unACKed.front().payload.size())
+          {
+            acked -= unACKed.front().payload.size();
+            unACKedBytes -= unACKed.front().payload.size();
+            if (sentCount > 0)
+            {
+              bytesInFlight -= unACKed.front().payload.size();
+              sentCount--;
+            }
+            unACKed.pop_front();
+          }
+          ack = serverACK;
+          rto_msecs = RTO_MSECS;
+          probe_msecs = RTO_MSECS;
+          timerExpiry = chrono::steady_clock::now() + chrono::milliseconds(rto_msecs);
+          updateWindow(cwnd, ssthresh, mss);
+        }
       }
     }
-
+    else if (chrono::steady_clock::now() >= timerExpiry)
+    {
+      if (rwnd == 0)
+      {
+        // zero window: probe with the oldest segment or one new byte, without
+        // treating the silence as congestion
+        if (unACKed.empty() && !fileDone)
+        {
+          if (readSource(source, buf, 1) == 0)
+          {
+            fileDone = true;
+          }
+          else
+          {
+            Segment segment;
+            segment.seq = nextSeq;
+            segment.payload.assign(buf, buf+1);
+            fileDigest = crc32c(fileDigest, buf, 1);
+            nextSeq = (nextSeq + 1) % (MAX_SEQACK+1);
+            unACKedBytes += 1;
+            unACKed.push_back(segment);
+          }
+        }
+        if (!unACKed.empty())
+        {
+          sendSegment(sockfd, serverAddr, connexID, unACKed.front(), cwnd, ssthresh, sentCount > 0, useCRC);
+          if (sentCount == 0)
+          {
+            bytesInFlight += unACKed.front().payload.size();
+            sentCount = 1;
+          }
+        }
+        probe_msecs = min(probe_msecs*2, MAX_PROBE_MSECS);
+        timerExpiry = chrono::steady_clock::now() + chrono::milliseconds(probe_msecs);
+      }
+      else if (!unACKed.empty())
+      {
+        // go back N: everything unACK'ed is resent as the window reopens
+        ssthresh = max(cwnd/2, (uint32_t)(2*mss));
+        cwnd = mss;
+        sentCount = 0;
+        bytesInFlight = 0;
+        rto_msecs = min(rto_msecs*2, MAX_RTO_MSECS);
+        timerExpiry = chrono::steady_clock::now() + chrono::milliseconds(rto_msecs);
+      }
+      else
+      {
+        timerExpiry = chrono::steady_clock::now() + chrono::milliseconds(rto_msecs);
+      }
+    }
+    end = chrono::system_clock::now();
   } //end of while
-  if (chrono::duration_cast<chrono::seconds>(end - start).count() >= 10)
+  if (chrono::duration_cast<chrono::seconds>(end - start).count() >= NO_RESPONSE_SECONDS)
   {
     printError("No response from server.");
     exitOnError(sockfd);
   }
 
-  fin.close();
+  source.file.close();
+  if (source.compress && source.rawBytes > 0)
+  {
+    cerr << "COMPRESSION " << source.blocks << " blocks " << source.rawBytes << " -> " << source.storedBytes
+         << " bytes, ratio " << fixed << setprecision(3) << (double)source.rawBytes/source.storedBytes
+         << ", " << (long)(source.cpuSeconds*1e3) << "ms CPU" << endl;
+  }
 
 
 //------- FIN/FIN ACK --------//
     Header fin_packet = createFIN(ack);
-    char finArray[DATA_SIZE];
-
-    convertHeaderToByteArray(fin_packet,finArray);
+    Options finOptions = noOptions();
+    if (useCRC)
+    {
+      // the server checks this against what it received before it answers
+      fin_packet.OPTflag = 1;
+      finOptions.hasDigest = true;
+      finOptions.digest = fileDigest;
+    }
+    char finArray[HEADER_SIZE+MAX_OPTIONS_SIZE+CRC_SIZE];
+    int finSize = buildPacket(fin_packet, finOptions, nullptr, 0, finArray);
+    if (useCRC)
+      finSize = appendTrailer(finArray, finSize);
 
-    if (sendto(sockfd, finArray, HEADER_SIZE, 0, (const sockaddr *)&serverAddr, sizeof(serverAddr)) == -1)
+    if (sendto(sockfd, finArray, finSize, 0, (const sockaddr *)&serverAddr, sizeof(serverAddr)) == -1)
     {
       printError("Unable to send FIN to server");
       exitOnError(sockfd);
     }
 
     printPacketDetails(fin_packet, SEND, cwnd, ssthresh);
+    bool receivedFINACK = false;
      start = chrono::system_clock::now();
      end = chrono::system_clock::now();
     while((chrono::duration_cast<chrono::seconds>(end - start).count() < 2))
@@ -438,7 +635,7 @@ void communicate(const int sockfd, const string filename, struct sockaddr_in ser
       poll(&fds, 1, timeout_msecs);
       if (fds.revents != 0)         // An event on sockfd has occurred.
       {
-        rec_res = recvfrom(sockfd, ackArray, HEADER_SIZE, 0, (struct sockaddr *)&serverAddr,&serverAddrLen);
+        rec_res = recvfrom(sockfd, ackArray, sizeof(ackArray), 0, (struct sockaddr *)&serverAddr,&serverAddrLen);
         if (rec_res == -1)
         {
           printError("Error in receiving FIN ACK from server");
@@ -453,28 +650,47 @@ void communicate(const int sockfd, const string filename, struct sockaddr_in ser
           }
           else
           {
+            receivedFINACK = true;
             printPacketDetails(ack, RECV, cwnd, ssthresh);
             Header finalACK = createFinalACK(ack);
-            convertHeaderToByteArray(finalACK,finArray);
-            if (sendto(sockfd, finArray, HEADER_SIZE, 0, (const sockaddr *)&serverAddr, sizeof(serverAddr)) == -1)
+            char finalACKArray[HEADER_SIZE+CRC_SIZE];
+            int finalACKSize = buildPacket(finalACK, noOptions(), nullptr, 0, finalACKArray);
+            if (useCRC)
+              finalACKSize = appendTrailer(finalACKArray, finalACKSize);
+            if (sendto(sockfd, finalACKArray, finalACKSize, 0, (const sockaddr *)&serverAddr, sizeof(serverAddr)) == -1)
             {
               printError("Unable to send FIN to server");
               exitOnError(sockfd);
             }
             printPacketDetails(finalACK, SEND, cwnd, ssthresh);
           }
+        }
       }
-    }}
+      else if (!receivedFINACK)
+      {
+        if (sendto(sockfd, finArray, finSize, 0, (const sockaddr *)&serverAddr, sizeof(serverAddr)) == -1)
+        {
+          printError("Unable to send FIN to server");
+          exitOnError(sockfd);
+        }
+        printPacketDetails(fin_packet, SEND, cwnd, ssthresh, true);
+      }
+    }
 
+    if (useCRC && !receivedFINACK)
+    {
+      printError("Server did not acknowledge the file digest.");
+      exitOnError(sockfd);
+    }
 
   //---------------------------------------//
 
 
 }
 
-long parsePort(char **argv)
+long parsePort(char *arg)
 {
-  long temp_port = strtol(argv[2],nullptr,10);
+  long temp_port = strtol(arg,nullptr,10);
   if(temp_port == 0 || temp_port==LONG_MAX || temp_port==LONG_MIN || (temp_port<1024)|| temp_port>65535)
     {
       printError("Port number needs to be a valid integer greater than 1023.");
@@ -483,12 +699,13 @@ long parsePort(char **argv)
   return temp_port;
 }
 
-string parseHost(char **argv)
+string parseHost(char *arg)
 {
   struct addrinfo hints, *info;
+  memset(&hints, 0, sizeof(hints));
   hints.ai_family = AF_INET;
 
-  if(getaddrinfo(argv[1], NULL,&hints,&info))
+  if(getaddrinfo(arg, NULL,&hints,&info))
     {
       printError("Host name is invalid.");
       printUsage();
@@ -500,23 +717,61 @@ string parseHost(char **argv)
   return (string)addr;
 }
 
+int parseMSS(char *arg)
+{
+  long temp_mss = strtol(arg,nullptr,10);
+  if(temp_mss<1 || temp_mss>MAX_DATA_SIZE)
+    {
+      printError("MSS needs to be an integer between 1 and "+to_string(MAX_DATA_SIZE)+".");
+      exit(1);
+    }
+  return temp_mss;
+}
+
 Arguments parseArguments(int argc, char**argv)
 {
-  if(argc!=(NUMBER_OF_ARGS+1))
+  Arguments args;
+  args.mss = MAX_DATA_SIZE;
+  args.crc = false;
+  args.compress = false;
+
+  int opt;
+  while((opt = getopt(argc, argv, "czm:r:")) != -1)
+    {
+      switch(opt)
+        {
+        case 'm':
+          args.mss = parseMSS(optarg);
+          break;
+        case 'c':
+          args.crc = true;
+          break;
+        case 'z':
+          args.compress = true;
+          break;
+        case 'r':
+          args.resumeToken = optarg;
+          break;
+        default:
+          printUsage();
+          exit(1);
+        }
+    }
+
+  if(argc-optind!=NUMBER_OF_ARGS)
     {
       printError("Incorrect number of arguments");
       printUsage();
       exit(1);
     }
-  Arguments args;
 
   // host
-  args.host = parseHost(argv);
+  args.host = parseHost(argv[optind]);
 
   // port
-  args.port = parsePort(argv);
+  args.port = parsePort(argv[optind+1]);
   // filename
-  args.filename = (string) argv[3];
+  args.filename = (string) argv[optind+2];
 
   return args;
 }
@@ -548,7 +803,7 @@ main(int argc, char **argv)
   struct sockaddr_in clientAddr = createClientAddr(sockfd);
 
   connectionSetup(clientAddr);
-  communicate(sockfd, args.filename, serverAddr);
+  communicate(sockfd, serverAddr, args);
   close(sockfd);
   return 0;
 }
@@ -0,0 +1,310 @@
+#ifndef CONFUNDO_H
+#define CONFUNDO_H
+
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "crc32c.h"
+#include "lz77.h"
+
+// Protocol definitions shared by the client and the server
+
+const int DATA_SIZE = 512;        // MSS used when none is negotiated
+const int MAX_DATA_SIZE = 16384;  // largest MSS either side will negotiate
+const int HEADER_SIZE = 12;
+const int MAX_OPTIONS_SIZE = 40;
+const int CRC_SIZE = 4;           // CRC32C trailer on client packets when negotiated
+const int PACKET_SIZE = HEADER_SIZE + DATA_SIZE;
+const int MAX_PACKET_SIZE = HEADER_SIZE + MAX_OPTIONS_SIZE + MAX_DATA_SIZE + CRC_SIZE;
+const int MAX_SEQACK = 102400;
+const int MAX_CWND = 51200;        // half the sequence space, so wrapped numbers stay unambiguous
+
+// With compression negotiated the payload stream is a sequence of blocks,
+// each an 8-byte header (raw length, stored length) and the stored bytes.
+const int COMPRESS_BLOCK_SIZE = LZ_MAX_OFFSET+1;
+const int BLOCK_HEADER_SIZE = 8;
+const uint32_t BLOCK_COMPRESSED = 0x80000000;   // stored length flag: LZ77 data
+
+const int OPT_MASK = 8;
+const int OPT_OFFSET = 3;
+const int ACK_MASK = 4;
+const int ACK_OFFSET = 2;
+const int SYN_MASK = 2;
+const int SYN_OFFSET = 1;
+const int FIN_MASK = 1;
+const int FLAG_POS = 11;
+
+// option kinds carried in the options block
+const int OPTION_MSS = 1;
+const int OPTION_RWND = 2;
+const int OPTION_RESUME = 3;
+const int OPTION_CRC = 4;
+const int OPTION_DIGEST = 5;
+const int OPTION_COMPRESS = 6;
+
+struct Header
+{
+  uint32_t sequenceNumber;
+  uint32_t acknowledgementNumber;
+  uint16_t connectionID;
+  bool ACKflag;
+  bool SYNflag;
+  bool FINflag;
+  bool OPTflag;
+};
+
+// Negotiated header extensions. A zero mss means the option is absent.
+struct Options
+{
+  uint16_t mss;
+  bool hasRwnd;
+  uint32_t rwnd;   // receive window in bytes, advertised by the server
+  bool hasResume;
+  uint64_t resumeToken;
+  uint64_t resumeOffset;   // bytes of the file the server already has
+  bool hasCRC;             // client packets end with a CRC32C trailer
+  bool hasDigest;
+  uint32_t digest;         // CRC32C of every payload byte, sent with the FIN
+  bool hasCompress;        // payload is a stream of (possibly) compressed blocks
+};
+
+inline int32_t getFlags(bool ACKflag, bool SYNflag, bool FINflag, bool OPTflag)
+{
+  return ((OPTflag<<OPT_OFFSET))|((ACKflag<<ACK_OFFSET))|((SYNflag<<SYN_OFFSET))|(FINflag);
+}
+
+// returns a 96 bit(12 byte) array representing the TCP header
+inline void convertHeaderToByteArray(Header h, char header[HEADER_SIZE])
+{
+  memset(&header[0], 0, HEADER_SIZE);
+  uint32_t seqNetwork = htonl(h.sequenceNumber);
+  uint32_t ackNetwork = (htonl(h.acknowledgementNumber));
+  //an int representing the third 'row' of the header
+  uint16_t connNetwork = htons(h.connectionID);
+  uint16_t ASFNetwork = htons(getFlags(h.ACKflag,h.SYNflag,h.FINflag,h.OPTflag));
+  memcpy(header, (char *)&seqNetwork, sizeof(uint32_t));
+  memcpy(header+4, (char *)&ackNetwork, sizeof(uint32_t));
+  memcpy(header+8, (char *)&connNetwork, sizeof(uint16_t));
+  memcpy(header+10, (char *)&ASFNetwork, sizeof(uint16_t));
+}
+
+inline Header convertByteArrayToHeader(char *h)
+{
+  Header res;
+  res.OPTflag = h[FLAG_POS]&OPT_MASK;
+  res.ACKflag = h[FLAG_POS]&ACK_MASK;
+  res.SYNflag = h[FLAG_POS]&SYN_MASK;
+  res.FINflag = h[FLAG_POS]&FIN_MASK;
+
+  memcpy(&res.sequenceNumber, (uint32_t *)h, sizeof(uint32_t));
+  memcpy(&res.acknowledgementNumber, (uint32_t *)&h[4], sizeof(uint32_t));
+  memcpy(&res.connectionID, (uint16_t *)&h[8], sizeof(uint16_t));
+
+  res.acknowledgementNumber = ntohl(res.acknowledgementNumber);
+  res.connectionID = ntohs(res.connectionID);
+  res.sequenceNumber = ntohl(res.sequenceNumber);
+
+  return res;
+}
+
+inline void putUint64(char *buf, uint64_t value)
+{
+  uint32_t high = htonl(value>>32);
+  uint32_t low = htonl(value&0xffffffff);
+  memcpy(buf, (char *)&high, sizeof(uint32_t));
+  memcpy(buf+4, (char *)&low, sizeof(uint32_t));
+}
+
+inline uint64_t getUint64(char *buf)
+{
+  uint32_t high, low;
+  memcpy(&high, buf, sizeof(uint32_t));
+  memcpy(&low, buf+4, sizeof(uint32_t));
+  return ((uint64_t)ntohl(high)<<32)|ntohl(low);
+}
+
+inline Options noOptions()
+{
+  Options o;
+  memset(&o, 0, sizeof(o));
+  return o;
+}
+
+// The options block follows the header when OPTflag is set. Its first byte is
+// the length of the whole block, followed by (kind, length, value) entries.
+// Returns the number of bytes written.
+inline int convertOptionsToByteArray(Options o, char *buf)
+{
+  int len = 1;
+  if(o.mss)
+  {
+    uint16_t mssNetwork = htons(o.mss);
+    buf[len] = OPTION_MSS;
+    buf[len+1] = sizeof(uint16_t);
+    memcpy(buf+len+2, (char *)&mssNetwork, sizeof(uint16_t));
+    len += 2+sizeof(uint16_t);
+  }
+  if(o.hasRwnd)
+  {
+    uint32_t rwndNetwork = htonl(o.rwnd);
+    buf[len] = OPTION_RWND;
+    buf[len+1] = sizeof(uint32_t);
+    memcpy(buf+len+2, (char *)&rwndNetwork, sizeof(uint32_t));
+    len += 2+sizeof(uint32_t);
+  }
+  if(o.hasResume)
+  {
+    buf[len] = OPTION_RESUME;
+    buf[len+1] = 2*sizeof(uint64_t);
+    putUint64(buf+len+2, o.resumeToken);
+    putUint64(buf+len+2+sizeof(uint64_t), o.resumeOffset);
+    len += 2+2*sizeof(uint64_t);
+  }
+  if(o.hasCRC)
+  {
+    buf[len] = OPTION_CRC;
+    buf[len+1] = 0;
+    len += 2;
+  }
+  if(o.hasDigest)
+  {
+    uint32_t digestNetwork = htonl(o.digest);
+    buf[len] = OPTION_DIGEST;
+    buf[len+1] = sizeof(uint32_t);
+    memcpy(buf+len+2, (char *)&digestNetwork, sizeof(uint32_t));
+    len += 2+sizeof(uint32_t);
+  }
+  if(o.hasCompress)
+  {
+    buf[len] = OPTION_COMPRESS;
+    buf[len+1] = 0;
+    len += 2;
+  }
+  buf[0] = len;
+  return len;
+}
+
+// Parses the options block at buf. Unknown kinds are skipped. Returns the
+// length of the block, or -1 if it is malformed.
+inline int convertByteArrayToOptions(char *buf, int size, Options &o)
+{
+  o = noOptions();
+  if(size<1)
+    return -1;
+  int len = (unsigned char)buf[0];
+  if(len<1 || len>size || len>MAX_OPTIONS_SIZE)
+    return -1;
+
+  int pos = 1;
+  while(pos+2<=len)
+  {
+    int kind = (unsigned char)buf[pos];
+    int valueLen = (unsigned char)buf[pos+1];
+    if(pos+2+valueLen>len)
+      return -1;
+    if(kind==OPTION_MSS && valueLen==sizeof(uint16_t))
+    {
+      memcpy(&o.mss, buf+pos+2, sizeof(uint16_t));
+      o.mss = ntohs(o.mss);
+    }
+    else if(kind==OPTION_RWND && valueLen==sizeof(uint32_t))
+    {
+      o.hasRwnd = true;
+      memcpy(&o.rwnd, buf+pos+2, sizeof(uint32_t));
+      o.rwnd = ntohl(o.rwnd);
+    }
+    else if(kind==OPTION_RESUME && valueLen==2*sizeof(uint64_t))
+    {
+      o.hasResume = true;
+      o.resumeToken = getUint64(buf+pos+2);
+      o.resumeOffset = getUint64(buf+pos+2+sizeof(uint64_t));
+    }
+    else if(kind==OPTION_CRC && valueLen==0)
+    {
+      o.hasCRC = true;
+    }
+    else if(kind==OPTION_DIGEST && valueLen==sizeof(uint32_t))
+    {
+      o.hasDigest = true;
+      memcpy(&o.digest, buf+pos+2, sizeof(uint32_t));
+      o.digest = ntohl(o.digest);
+    }
+    else if(kind==OPTION_COMPRESS && valueLen==0)
+    {
+      o.hasCompress = true;
+    }
+    pos += 2+valueLen;
+  }
+  return len;
+}
+
+// Writes header, options (when h.OPTflag is set) and payload into packet.
+// Returns the datagram length.
+inline int buildPacket(Header h, Options o, const char *payload, int size, char *packet)
+{
+  convertHeaderToByteArray(h, packet);
+  int len = HEADER_SIZE;
+  if(h.OPTflag)
+    len += convertOptionsToByteArray(o, packet+len);
+  if(size>0)
+    memcpy(packet+len, payload, size);
+  return len+size;
+}
+
+// Appends the CRC32C of the first len bytes. Returns the new length.
+inline int appendTrailer(char *packet, int len)
+{
+  uint32_t crcNetwork = htonl(crc32c(0, packet, len));
+  memcpy(packet+len, (char *)&crcNetwork, CRC_SIZE);
+  return len+CRC_SIZE;
+}
+
+// Checks and removes the trailer; on success len no longer counts it.
+inline bool stripTrailer(char *packet, int &len)
+{
+  if(len<HEADER_SIZE+CRC_SIZE)
+    return false;
+  uint32_t crcNetwork;
+  memcpy(&crcNetwork, packet+len-CRC_SIZE, CRC_SIZE);
+  if(ntohl(crcNetwork)!=crc32c(0, packet, len-CRC_SIZE))
+    return false;
+  len -= CRC_SIZE;
+  return true;
+}
+
+inline void putBlockHeader(char *buf, uint32_t rawLen, uint32_t storedLen, bool compressed)
+{
+  uint32_t rawNetwork = htonl(rawLen);
+  uint32_t storedNetwork = htonl(storedLen|(compressed ? BLOCK_COMPRESSED : 0));
+  memcpy(buf, (char *)&rawNetwork, sizeof(uint32_t));
+  memcpy(buf+4, (char *)&storedNetwork, sizeof(uint32_t));
+}
+
+inline void getBlockHeader(const char *buf, uint32_t &rawLen, uint32_t &storedLen, bool &compressed)
+{
+  memcpy(&rawLen, buf, sizeof(uint32_t));
+  memcpy(&storedLen, buf+4, sizeof(uint32_t));
+  rawLen = ntohl(rawLen);
+  storedLen = ntohl(storedLen);
+  compressed = storedLen&BLOCK_COMPRESSED;
+  storedLen &= ~BLOCK_COMPRESSED;
+}
+
+// Splits a received datagram into header and options. Returns the offset of
+// the payload, or -1 if the datagram is malformed.
+inline int parsePacket(char *packet, int size, Header &h, Options &o)
+{
+  o = noOptions();
+  if(size<HEADER_SIZE)
+    return -1;
+  h = convertByteArrayToHeader(packet);
+  if(!h.OPTflag)
+    return HEADER_SIZE;
+  int len = convertByteArrayToOptions(packet+HEADER_SIZE, size-HEADER_SIZE, o);
+  if(len<0)
+    return -1;
+  return HEADER_SIZE+len;
+}
+
+#endif
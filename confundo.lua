@@ -1,39 +1,75 @@
-confundo = Proto("confundo", "CS118 Confundo Transport Protocol (CTP)")
-
-local f_seqno  = ProtoField.uint32("confundo.seqno",        "Sequence Number")
-local f_ack    = ProtoField.uint32("confundo.ack",          "ACK Number")
-local f_id     = ProtoField.uint16("confundo.connectionId", "Connection ID")
-local f_flags  = ProtoField.uint16("confundo.flags",        "Flags")
-
-confundo.fields = { f_seqno, f_ack, f_id, f_flags }
-
-function confundo.dissector(tvb, pInfo, root) -- Tvb, Pinfo, TreeItem
-   if (tvb:len() ~= tvb:reported_len()) then
-      return 0
-   end
-
-   local t = root:add(confundo, tvb(0,12))
-   t:add(f_seqno, tvb(0,4))
-   t:add(f_ack, tvb(4,4))
-   t:add(f_id, tvb(8,2))
-   local f = t:add(f_flags, tvb(10,2))
-
-   local flag = tvb(11,1):uint()
-
-   if bit.band(flag, 1) ~= 0 then
-      f:add(tvb(11,1), "FIN")
-   end
-   if bit.band(flag, 2) ~= 0 then
-      f:add(tvb(11,1), "SYN")
-   end
-   if bit.band(flag, 4) ~= 0 then
-      f:add(tvb(11,1), "ACK")
-   end
-  
-   pInfo.cols.protocol = "Confundo"
-end
-
-local udpDissectorTable = DissectorTable.get("udp.port")
-udpDissectorTable:add("5000", confundo)
-
-io.stderr:write("confundo.lua is successfully loaded\n")
+confundo = Proto("confundo", "CS118 Confundo Transport Protocol (CTP)")
+
+local f_seqno  = ProtoField.uint32("confundo.seqno",        "Sequence Number")
+local f_ack    = ProtoField.uint32("confundo.ack",          "ACK Number")
+local f_id     = ProtoField.uint16("confundo.connectionId", "Connection ID")
+local f_flags  = ProtoField.uint16("confundo.flags",        "Flags")
+local f_optlen = ProtoField.uint8("confundo.options.len",   "Options Length")
+local f_mss    = ProtoField.uint16("confundo.options.mss",  "Maximum Segment Size")
+local f_rwnd   = ProtoField.uint32("confundo.options.rwnd", "Receive Window")
+local f_token  = ProtoField.uint64("confundo.options.resume_token",  "Resume Token", base.HEX)
+local f_offset = ProtoField.uint64("confundo.options.resume_offset", "Resume Offset")
+local f_crc    = ProtoField.none("confundo.options.crc",      "CRC32C Trailers")
+local f_digest = ProtoField.uint32("confundo.options.digest", "File Digest", base.HEX)
+
+confundo.fields = { f_seqno, f_ack, f_id, f_flags, f_optlen, f_mss, f_rwnd, f_token, f_offset,
+                     f_crc, f_digest }
+
+local function dissect_options(tvb, t)
+   local len = tvb(0,1):uint()
+   local o = t:add(f_optlen, tvb(0,1))
+   local pos = 1
+   while pos + 2 <= len do
+      local kind = tvb(pos,1):uint()
+      local vlen = tvb(pos+1,1):uint()
+      if kind == 1 and vlen == 2 then
+         o:add(f_mss, tvb(pos+2,2))
+      elseif kind == 2 and vlen == 4 then
+         o:add(f_rwnd, tvb(pos+2,4))
+      elseif kind == 3 and vlen == 16 then
+         o:add(f_token, tvb(pos+2,8))
+         o:add(f_offset, tvb(pos+10,8))
+      elseif kind == 4 and vlen == 0 then
+         o:add(f_crc, tvb(pos,2))
+      elseif kind == 5 and vlen == 4 then
+         o:add(f_digest, tvb(pos+2,4))
+      end
+      pos = pos + 2 + vlen
+   end
+   return len
+end
+
+function confundo.dissector(tvb, pInfo, root) -- Tvb, Pinfo, TreeItem
+   if (tvb:len() ~= tvb:reported_len()) then
+      return 0
+   end
+
+   local t = root:add(confundo, tvb(0,12))
+   t:add(f_seqno, tvb(0,4))
+   t:add(f_ack, tvb(4,4))
+   t:add(f_id, tvb(8,2))
+   local f = t:add(f_flags, tvb(10,2))
+
+   local flag = tvb(11,1):uint()
+
+   if bit.band(flag, 1) ~= 0 then
+      f:add(tvb(11,1), "FIN")
+   end
+   if bit.band(flag, 2) ~= 0 then
+      f:add(tvb(11,1), "SYN")
+   end
+   if bit.band(flag, 4) ~= 0 then
+      f:add(tvb(11,1), "ACK")
+   end
+   if bit.band(flag, 8) ~= 0 then
+      f:add(tvb(11,1), "OPT")
+      dissect_options(tvb(12), t)
+   end
+  
+   pInfo.cols.protocol = "Confundo"
+end
+
+local udpDissectorTable = DissectorTable.get("udp.port")
+udpDissectorTable:add("5000", confundo)
+
+io.stderr:write("confundo.lua is successfully loaded\n")
@@ -0,0 +1,151 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+// CRC32C (Castagnoli). crc32c() picks the fastest kernel the CPU supports the
+// first time it is called: SSE4.2 or ARMv8 CRC instructions, otherwise
+// slicing-by-8 tables. Each kernel continues from a running crc, so a digest
+// can be built up one segment at a time:
+//
+//   uint32_t crc = 0;
+//   crc = crc32c(crc, a, aLen);
+//   crc = crc32c(crc, b, bLen);
+
+const uint32_t CRC32C_POLY = 0x82f63b78;   // reflected Castagnoli polynomial
+
+struct Crc32cTables
+{
+  uint32_t t[8][256];
+
+  Crc32cTables()
+  {
+    for(int i = 0; i<256; i++)
+    {
+      uint32_t crc = i;
+      for(int j = 0; j<8; j++)
+        crc = (crc>>1)^(CRC32C_POLY&(0-(crc&1)));
+      t[0][i] = crc;
+    }
+    for(int i = 0; i<256; i++)
+      for(int k = 1; k<8; k++)
+        t[k][i] = (t[k-1][i]>>8)^t[0][t[k-1][i]&0xff];
+  }
+};
+
+inline const Crc32cTables &crc32cTables()
+{
+  static const Crc32cTables tables;
+  return tables;
+}
+
+// one byte at a time, the reference the other kernels are checked against
+inline uint32_t crc32cBytewise(uint32_t crc, const char *data, size_t len)
+{
+  const uint32_t (&t)[8][256] = crc32cTables().t;
+  const unsigned char *p = (const unsigned char *)data;
+  crc = ~crc;
+  while(len--)
+    crc = (crc>>8)^t[0][(crc^*p++)&0xff];
+  return ~crc;
+}
+
+inline uint32_t crc32cSlicingBy8(uint32_t crc, const char *data, size_t len)
+{
+  const uint32_t (&t)[8][256] = crc32cTables().t;
+  const unsigned char *p = (const unsigned char *)data;
+  crc = ~crc;
+  while(len>=8)
+  {
+    // little-endian word; the tables assume the low byte comes first
+    uint32_t low = (uint32_t)p[0]|((uint32_t)p[1]<<8)|((uint32_t)p[2]<<16)|((uint32_t)p[3]<<24);
+    uint32_t high = (uint32_t)p[4]|((uint32_t)p[5]<<8)|((uint32_t)p[6]<<16)|((uint32_t)p[7]<<24);
+    low ^= crc;
+    crc = t[7][low&0xff]^t[6][(low>>8)&0xff]^t[5][(low>>16)&0xff]^t[4][low>>24]^
+          t[3][high&0xff]^t[2][(high>>8)&0xff]^t[1][(high>>16)&0xff]^t[0][high>>24];
+    p += 8;
+    len -= 8;
+  }
+  while(len--)
+    crc = (crc>>8)^t[0][(crc^*p++)&0xff];
+  return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+inline uint32_t crc32cHardware(uint32_t crc, const char *data, size_t len)
+{
+  uint64_t c = ~crc;
+  while(len>=8)
+  {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    c = _mm_crc32_u64(c, word);
+    data += 8;
+    len -= 8;
+  }
+  uint32_t c32 = c;
+  while(len--)
+    c32 = _mm_crc32_u8(c32, *data++);
+  return ~c32;
+}
+
+inline bool crc32cHardwareAvailable()
+{
+  return __builtin_cpu_supports("sse4.2");
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+inline uint32_t crc32cHardware(uint32_t crc, const char *data, size_t len)
+{
+  crc = ~crc;
+  while(len>=8)
+  {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc = __crc32cd(crc, word);
+    data += 8;
+    len -= 8;
+  }
+  while(len--)
+    crc = __crc32cb(crc, *data++);
+  return ~crc;
+}
+
+inline bool crc32cHardwareAvailable()
+{
+  return true;
+}
+#else
+inline uint32_t crc32cHardware(uint32_t crc, const char *data, size_t len)
+{
+  return crc32cSlicingBy8(crc, data, len);
+}
+
+inline bool crc32cHardwareAvailable()
+{
+  return false;
+}
+#endif
+
+typedef uint32_t (*Crc32cKernel)(uint32_t, const char *, size_t);
+
+inline Crc32cKernel crc32cKernel()
+{
+  static const Crc32cKernel kernel = crc32cHardwareAvailable() ? crc32cHardware : crc32cSlicingBy8;
+  return kernel;
+}
+
+inline uint32_t crc32c(uint32_t crc, const char *data, size_t len)
+{
+  return crc32cKernel()(crc, data, len);
+}
+
+#endif
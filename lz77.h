@@ -0,0 +1,159 @@
+#ifndef LZ77_H
+#define LZ77_H
+
+#include <stdint.h>
+#include <string.h>
+
+// A small LZ77 block codec in the style of LZ4. A block is a list of
+// sequences, each a token byte followed by literals and a back reference:
+//
+//   token       high nibble: literal count, low nibble: match length - 4;
+//               15 means more length bytes follow (255 = keep adding)
+//   literals    copied as they are
+//   offset      2 bytes, little-endian, distance back into the output
+//
+// The last sequence has literals only; the block ends after them. Blocks are
+// at most LZ_MAX_OFFSET+1 bytes, so every offset fits in 16 bits.
+
+const int LZ_MIN_MATCH = 4;
+const int LZ_MAX_OFFSET = 65535;
+const int LZ_HASH_BITS = 13;
+const int LZ_SKIP_SHIFT = 6;   // scan faster through data that does not match
+
+inline uint32_t lzHash(const unsigned char *p)
+{
+  uint32_t word;
+  memcpy(&word, p, sizeof(word));
+  return (word*2654435761u)>>(32-LZ_HASH_BITS);
+}
+
+inline bool lzPutLength(unsigned char *&out, const unsigned char *outEnd, int len)
+{
+  for(; len>=255; len -= 255)
+  {
+    if(out>=outEnd)
+      return false;
+    *out++ = 255;
+  }
+  if(out>=outEnd)
+    return false;
+  *out++ = len;
+  return true;
+}
+
+// writes one sequence; a matchLen of 0 ends the block after the literals
+inline bool lzPutSequence(unsigned char *&out, const unsigned char *outEnd, const unsigned char *literals, int litLen, int offset, int matchLen)
+{
+  if(outEnd-out<1+litLen)
+    return false;
+  unsigned char *token = out++;
+  *token = (litLen<15 ? litLen : 15)<<4;
+  if(litLen>=15 && !lzPutLength(out, outEnd, litLen-15))
+    return false;
+  if(outEnd-out<litLen)
+    return false;
+  memcpy(out, literals, litLen);
+  out += litLen;
+  if(matchLen==0)
+    return true;
+
+  if(outEnd-out<2)
+    return false;
+  *out++ = offset&0xff;
+  *out++ = offset>>8;
+  int extra = matchLen-LZ_MIN_MATCH;
+  *token |= extra<15 ? extra : 15;
+  return extra<15 || lzPutLength(out, outEnd, extra-15);
+}
+
+// Compresses srcLen bytes into at most dstCapacity bytes. Returns the
+// compressed size, or 0 if the result would not fit.
+inline int lzCompress(const char *src, int srcLen, char *dst, int dstCapacity)
+{
+  int table[1<<LZ_HASH_BITS];
+  memset(table, 0xff, sizeof(table));
+
+  const unsigned char *in = (const unsigned char *)src;
+  unsigned char *out = (unsigned char *)dst;
+  const unsigned char *outEnd = out+dstCapacity;
+  int anchor = 0;
+  int pos = 0;
+  while(pos+LZ_MIN_MATCH<=srcLen)
+  {
+    uint32_t h = lzHash(in+pos);
+    int candidate = table[h];
+    table[h] = pos;
+    if(candidate<0 || pos-candidate>LZ_MAX_OFFSET || memcmp(in+candidate, in+pos, LZ_MIN_MATCH)!=0)
+    {
+      pos += 1+((pos-anchor)>>LZ_SKIP_SHIFT);
+      continue;
+    }
+
+    int matchLen = LZ_MIN_MATCH;
+    while(pos+matchLen<srcLen && in[candidate+matchLen]==in[pos+matchLen])
+      matchLen++;
+    if(!lzPutSequence(out, outEnd, in+anchor, pos-anchor, pos-candidate, matchLen))
+      return 0;
+    pos += matchLen;
+    anchor = pos;
+  }
+  if(!lzPutSequence(out, outEnd, in+anchor, srcLen-anchor, 0, 0))
+    return 0;
+  return out-(unsigned char *)dst;
+}
+
+inline bool lzGetLength(const unsigned char *&in, const unsigned char *inEnd, int &len)
+{
+  unsigned char b;
+  do
+  {
+    if(in>=inEnd)
+      return false;
+    b = *in++;
+    len += b;
+  } while(b==255);
+  return true;
+}
+
+// Decompresses a block into at most dstCapacity bytes. Returns the
+// decompressed size, or -1 if the block is malformed.
+inline int lzDecompress(const char *src, int srcLen, char *dst, int dstCapacity)
+{
+  const unsigned char *in = (const unsigned char *)src;
+  const unsigned char *inEnd = in+srcLen;
+  unsigned char *out = (unsigned char *)dst;
+  unsigned char *outEnd = out+dstCapacity;
+  while(in<inEnd)
+  {
+    int token = *in++;
+    int litLen = token>>4;
+    if(litLen==15 && !lzGetLength(in, inEnd, litLen))
+      return -1;
+    if(inEnd-in<litLen || outEnd-out<litLen)
+      return -1;
+    memcpy(out, in, litLen);
+    in += litLen;
+    out += litLen;
+    if(in==inEnd)
+      break;
+
+    if(inEnd-in<2)
+      return -1;
+    int offset = in[0]|(in[1]<<8);
+    in += 2;
+    int matchLen = token&15;
+    if(matchLen==15 && !lzGetLength(in, inEnd, matchLen))
+      return -1;
+    matchLen += LZ_MIN_MATCH;
+    if(offset==0 || offset>out-(unsigned char *)dst || outEnd-out<matchLen)
+      return -1;
+    // byte by byte, since a match may overlap the bytes it produces
+    const unsigned char *match = out-offset;
+    for(int i = 0; i<matchLen; i++)
+      out[i] = match[i];
+    out += matchLen;
+  }
+  return out-(unsigned char *)dst;
+}
+
+#endif
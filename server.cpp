@@ -1,507 +1,1121 @@
-#include <sys/types.h>
-#include <sys/socket.h>
-#include <sys/time.h>
-#include <sys/stat.h>
-#include <netinet/in.h>
-#include <arpa/inet.h>
-#include <string.h>
-#include <fcntl.h>
-#include <stdio.h>
-#include <errno.h>
-#include <stdint.h>
-#include <unistd.h>
-
-#include <iostream>
-#include <fstream>
-#include <unordered_map>
-#include <iomanip>
-#include <cstdint>
-#include <iostream>
-#include <thread>
-#include <chrono>
-#include <csignal>
-#include <climits>
-
-using namespace std;
-
-const int NUMBER_OF_ARGS = 2;
-const int MAX_CLIENT_NUMBER = 12;
-const int DATA_SIZE = 512;
-const int HEADER_SIZE = 12;
-const int PACKET_SIZE = HEADER_SIZE + DATA_SIZE;
-const int MAX_SEQACK = 102400;
-
-const int ACK_MASK = 4;
-const int ACK_OFFSET = 2;
-const int SYN_MASK = 2;
-const int SYN_OFFSET = 1;
-const int FIN_MASK = 1;
-const int FLAG_POS = 11;
-
-struct Header
-{
-  uint32_t sequenceNumber;
-  uint32_t acknowledgementNumber;
-  uint16_t connectionID;
-  bool ACKflag;
-  bool SYNflag;
-  bool FINflag;
-};
-
-int client_number = 1;
-unordered_map<uint16_t,uint32_t> connToNextExpectedSeq;
-unordered_map<uint16_t,Header> connToLastInOrderACKSent;
-
-int32_t getFlags(bool ACKflag, bool SYNflag, bool FINflag)
-{
-  return ((ACKflag<<ACK_OFFSET))|((SYNflag<<SYN_OFFSET))|(FINflag);
-}
-
-// returns a 96 bit(12 byte) array representing the TCP header
-void convertHeaderToByteArray(Header h, char header[HEADER_SIZE])
-{
-  memset(&header[0], 0, HEADER_SIZE);
-  uint32_t seqNetwork = htonl(h.sequenceNumber);
-  uint32_t ackNetwork = (htonl(h.acknowledgementNumber));
-  //an int representing the third 'row' of the header
-  uint16_t connNetwork = htons(h.connectionID);
-  uint16_t ASFNetwork = htons(getFlags(h.ACKflag,h.SYNflag,h.FINflag));
-  memcpy(header, (char *)&seqNetwork, sizeof(uint32_t));
-  memcpy(header+4, (char *)&ackNetwork, sizeof(uint32_t));
-  memcpy(header+8, (char *)&connNetwork, sizeof(uint16_t));
-  memcpy(header+10, (char *)&ASFNetwork, sizeof(uint16_t));
-}
-
-Header convertByteArrayToHeader(char *h)
-{
-  Header res;
-  res.ACKflag = h[FLAG_POS]&ACK_MASK;
-  res.SYNflag = h[FLAG_POS]&SYN_MASK;
-  res.FINflag = h[FLAG_POS]&FIN_MASK;
-
-  memcpy(&res.sequenceNumber, (uint32_t *)h, sizeof(uint32_t));
-  memcpy(&res.acknowledgementNumber, (uint32_t *)&h[4], sizeof(uint32_t));
-  memcpy(&res.connectionID, (uint16_t *)&h[8], sizeof(uint16_t));
-
-  res.acknowledgementNumber = ntohl(res.acknowledgementNumber);
-  res.connectionID = ntohs(res.connectionID);
-  res.sequenceNumber = ntohl(res.sequenceNumber);
-
-  return res;
-}
-
-struct Arguments
-{
-  int port;
-  string fileDir;
-};
-
-void printUsage()
-{
-  cerr<< "USAGE: ./server <PORT> <FILE-DIR>\n";
-}
-
-void printError(string message)
-{
-  cerr<<"ERROR: ";
-  cerr<< message <<endl;
-}
-
-void sigHandler(int n)
-{
-  if(n == SIGTERM || n == SIGQUIT)
-    {
-      exit(0);
-    }
-  else
-    {
-      printError("Signal "+to_string(n)+" received.");
-      exit(1);
-    }
-}
-
-
-long parsePort(char **argv)
-{
-  long temp_port = strtol(argv[1],nullptr,10);
-  if(temp_port == 0 || temp_port==LONG_MAX || temp_port==LONG_MIN || (temp_port<1024) || temp_port>65535)
-    {
-      printError("Port number needs to be a valid integer greater than 1023.");
-      exit(1);
-    }
-  return temp_port;
-}
-
-void exitOnError(int sockfd)
-{
-  close(sockfd);
-  exit(1);
-}
-
-void createDirIfNotExists(string path)
-{
-  struct stat s;
-
-  if(!(stat(path.c_str(), &s) == 0 &&S_ISDIR(s.st_mode)))
-    {
-      if(mkdir(path.c_str(), 0777)<0)
-        {
-	        printError("Unable to create directory.");
-	        exit(1);
-        }
-
-    }
-}
-
-Arguments parseArguments(int argc, char**argv)
-{
-  if(argc!=(NUMBER_OF_ARGS+1))
-    {
-      printError("Incorrect number of arguments");
-      printUsage();
-      exit(1);
-    }
-  Arguments args;
-
-  // port
-  args.port = parsePort(argv);
-
-  // directory
-  createDirIfNotExists(string(argv[2]));
-  args.fileDir = (string) argv[2];
-
-  return args;
-}
-
-void setReuse(const int sockfd)
-{
-  // allow others to reuse the address
-  int yes = 1;
-  if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1) {
-    printError("setsockopt() failed.");
-    exitOnError(sockfd);
-  }
-}
-
-bool hasNoFlags(Header packet_header)
-{
-  return !packet_header.FINflag&&!packet_header.ACKflag&&!packet_header.SYNflag;
-}
-
-
-struct sockaddr_in createServerAddr(const int sockfd, const int port)
-{
-  // bind address to socket
-  struct sockaddr_in addr;
-  memset((char *)&addr, 0, sizeof(addr));
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons(port);     // short, network byte order
-  addr.sin_addr.s_addr = htonl(INADDR_ANY);
-  return addr;
-}
-
-void bindSocket(const int sockfd, const sockaddr_in addr)
-{
-  if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) <0)
-    {
-      printError("bind() failed.");
-      exitOnError(sockfd);
-    }
-}
-
-string getFileName(string fileDir, int num)
-{
-  return fileDir +"/" + to_string(num) + ".file";
-}
-
-// creates the SYNACK for the 3-way handshake
-Header createSYNACK(Header clientSyn)
-{
-  Header serverSynAck;
-  serverSynAck.ACKflag = 1;
-  serverSynAck.connectionID = client_number;
-  serverSynAck.SYNflag = 1;
-  serverSynAck.FINflag = 0;
-  serverSynAck.sequenceNumber = 4321;
-  serverSynAck.acknowledgementNumber = clientSyn.sequenceNumber+1;
-  return serverSynAck;
-}
-
-bool beginNewConnection(Header packet)
-{
-  return packet.SYNflag&&!packet.ACKflag&&!packet.FINflag&&(packet.connectionID==0);
-}
-
-bool outOfOrder(Header packet_header)
-{
-  return !beginNewConnection(packet_header)&&connToLastInOrderACKSent[packet_header.connectionID].acknowledgementNumber != packet_header.sequenceNumber;
-}
-
-Header createACKHandshake(Header client, uint32_t payloadSize)
-{
-  Header serverACK;
-  serverACK.SYNflag = 0;
-  serverACK.FINflag = 0;
-  serverACK.ACKflag = 1;
-
-  serverACK.connectionID = client.connectionID;
-  serverACK.acknowledgementNumber = client.sequenceNumber;
-
-  if(hasNoFlags(client))
-  {
-    serverACK.sequenceNumber = connToLastInOrderACKSent[client.connectionID].sequenceNumber;
-  }
-  else
-  {
-    serverACK.sequenceNumber = client.acknowledgementNumber;
-  }
-
-  if(payloadSize>0)
-  {
-    serverACK.acknowledgementNumber+=payloadSize;
-  }
-  else if(client.SYNflag)
-  {
-    serverACK.acknowledgementNumber++;
-  }
-
-  if(serverACK.acknowledgementNumber>MAX_SEQACK)
-  {
-    serverACK.acknowledgementNumber = serverACK.acknowledgementNumber% (MAX_SEQACK + 1);// + payloadSize;
-  }
-  if(serverACK.sequenceNumber>MAX_SEQACK)
-  {
-    serverACK.sequenceNumber = serverACK.sequenceNumber% (MAX_SEQACK + 1);
-  }
-
-
-  return serverACK;
-}
-
-bool receivedACK(Header packet)
-{
-  return packet.ACKflag&&!packet.FINflag&&!packet.SYNflag;
-}
-
-void createNewFile(int num, string fileDir)
-{
-  fstream fout;
-  fout.open(getFileName(fileDir,num), ios::out);
-  fout.close();
-}
-
-void writePayloadToFile(int num, string fileDir, char * payload, int size)
-{
-  fstream fout;
-  fout.open(getFileName(fileDir,num), ios::app);
-  fout.write(payload, size);
-  fout.close();
-}
-
-enum msgType{RECV,SEND,DROP};
-
-void printPacketDetails(Header packet_header, msgType type, bool dup=false)
-{
-  if(type==DROP)
-    cout<<"DROP ";
-  else if(type==RECV)
-    cout<<"RECV ";
-  else
-    cout<<"SEND ";
-
-  cout<<packet_header.sequenceNumber<<" "<<packet_header.acknowledgementNumber<<" "<<packet_header.connectionID;
-
-  if(packet_header.ACKflag)
-    cout<<" "<<"ACK";
-  if(packet_header.SYNflag)
-    cout<<" "<<"SYN";
-  if(packet_header.FINflag)
-    cout<<" "<<"FIN";
-  if(type==SEND && dup)
-    cout<<" DUP";
-
-  cout<<endl;
-}
-
-bool receivedFIN(Header packet_header)
-{
-  return !packet_header.SYNflag&&packet_header.FINflag&&!packet_header.ACKflag;
-}
-
-Header createFINACK(Header packet_header)
-{
-  Header serverFINACK;
-  serverFINACK.ACKflag = 1;
-  serverFINACK.SYNflag = 0;
-  serverFINACK.FINflag = 1;
-
-  serverFINACK.sequenceNumber = connToLastInOrderACKSent[packet_header.connectionID].sequenceNumber;
-
-  serverFINACK.connectionID = packet_header.connectionID;
-  serverFINACK.acknowledgementNumber = packet_header.sequenceNumber+1;
-
-
-  if(serverFINACK.acknowledgementNumber>MAX_SEQACK)
-  {
-    serverFINACK.acknowledgementNumber = serverFINACK.acknowledgementNumber % (MAX_SEQACK + 1);
-  }
-  if(serverFINACK.sequenceNumber>MAX_SEQACK)
-  {
-    serverFINACK.sequenceNumber = serverFINACK.sequenceNumber % (MAX_SEQACK + 1);
-  }
-
-  return serverFINACK;
-}
-
-bool isValidConnectionStart(Header packet_header)
-{
-  return (beginNewConnection(packet_header)&&packet_header.acknowledgementNumber == 0 && packet_header.sequenceNumber == 12345);
-}
-
-bool isValidPacket(Header packet_header)
-{
-  return ((packet_header.connectionID<client_number) && (packet_header.connectionID>0)&&(packet_header.sequenceNumber<=MAX_SEQACK)&&(packet_header.acknowledgementNumber<=MAX_SEQACK))|| isValidConnectionStart(packet_header);
-}
-
-void listenForPackets(int clientSockfd, string fileDir)
-{
-  // read/write data from/into the connection
-  bool isEnd = false;
-  bool dup = false;
-  char buf[PACKET_SIZE] = {0};
-
-  while (!isEnd)
-    {
-      memset(buf, '\0', sizeof(buf));
-      struct sockaddr_in clientAddr;
-      socklen_t clientAddrSize = sizeof(clientAddr);
-      dup = false;
-
-      int rec_res = recvfrom(clientSockfd, buf, PACKET_SIZE, 0, (struct sockaddr *)&clientAddr,&clientAddrSize);
-
-      if (rec_res == -1 && errno!=EWOULDBLOCK)
-        {
-	        printError("Error in receiving data");
-          exitOnError(clientSockfd);
-        }
-      else if(!rec_res)
-        {
-          break;
-        }
-      if(rec_res > 0)
-      {
-        char header[HEADER_SIZE];
-        memcpy(header, buf, HEADER_SIZE);
-        Header packet_header = convertByteArrayToHeader(header);
-        Header response;
-        char responsePacket[HEADER_SIZE];
-
-        // print details
-        if(outOfOrder(packet_header))
-        {
-          response = connToLastInOrderACKSent[packet_header.connectionID];
-          dup = true;
-          printPacketDetails(packet_header,DROP);
-        }
-        else if(!isValidPacket(packet_header))
-        {
-          printPacketDetails(packet_header,DROP);
-          continue;
-        }
-        else if(!outOfOrder(packet_header))
-        {
-          printPacketDetails(packet_header,RECV);
-          // if SYN then start 3 way handshake -> create new connection state
-          if (beginNewConnection(packet_header))
-          {
-            response = createSYNACK(packet_header);
-            connToNextExpectedSeq[response.connectionID] = response.acknowledgementNumber;
-            connToLastInOrderACKSent[response.connectionID] = response;
-            createNewFile(client_number,fileDir);
-            client_number++;
-          }
-          else if((receivedACK(packet_header)||hasNoFlags(packet_header)))
-          {
-            response = createACKHandshake(packet_header, rec_res-HEADER_SIZE);
-            connToLastInOrderACKSent[packet_header.connectionID] = response;
-            connToNextExpectedSeq[packet_header.connectionID] = response.acknowledgementNumber;
-            // write to file
-            writePayloadToFile(packet_header.connectionID,fileDir,buf+HEADER_SIZE, rec_res-HEADER_SIZE);
-          }
-          else if(receivedFIN(packet_header))
-          {
-            response = createFINACK(packet_header);
-            connToLastInOrderACKSent[packet_header.connectionID] = response;
-            connToNextExpectedSeq[packet_header.connectionID] = response.acknowledgementNumber;
-          }
-        }
-        convertHeaderToByteArray(response,responsePacket);
-
-        if(!receivedACK(packet_header) && isValidPacket(packet_header))
-        {
-          if (sendto(clientSockfd, responsePacket, HEADER_SIZE, 0, (const sockaddr *)&clientAddr, clientAddrSize) == -1)
-          {
-            printError("Unable to send data to server");
-            exitOnError(clientSockfd);
-          }
-          printPacketDetails(response,SEND,dup);
-        }
-      }
-
-    }
-}
-
-void setupEnvironment(const int sockfd)
-{
-  int flags = fcntl(sockfd, F_GETFL, 0);
-  if(flags<0)
-    {
-      printError("fcntl() failed");
-      exit(1);
-    }
-  if(fcntl(sockfd,F_SETFL,flags|O_NONBLOCK)<0)
-    {
-      printError("fcntl() failed.");
-      exit(1);
-    }
-}
-
-void worker(int clientSockfd, int n, string fileDir)
-{
-  setupEnvironment(clientSockfd);
-  listenForPackets(clientSockfd, fileDir);
-  close(clientSockfd);
-}
-
-int main(int argc, char **argv)
-{
-  Arguments args = parseArguments(argc, argv);
-
-  signal(SIGTERM, sigHandler);
-  signal(SIGQUIT, sigHandler);
-
-  // create a socket using UDP IP
-  int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-
-  if(sockfd < 0)
-  {
-    printError("fcntl() failed");
-    exit(1);
-  }
-
-  setReuse(sockfd);
-  setupEnvironment(sockfd);
-
-  struct sockaddr_in addr = createServerAddr(sockfd, args.port);
-
-  bindSocket(sockfd, addr);
-
-  // set socket to listen status
-  while (true)
-    {
-      worker(sockfd,client_number,args.fileDir);
-    }
-  close(sockfd);
-
-  return 0;
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <dirent.h>
+
+#include <iostream>
+#include <fstream>
+#include <unordered_map>
+#include <iomanip>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <csignal>
+#include <climits>
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
+
+#include "confundo.h"
+
+using namespace std;
+
+const int NUMBER_OF_ARGS = 2;
+const int MAX_CLIENT_NUMBER = 12;
+const int MAX_CONNECTION_ID = 65535;
+const int COOKIE_SLOT_SECONDS = 64;
+const int POLL_TIMEOUT_MSECS = 100;
+const uint32_t RECV_BUFFER_SIZE = 65536;    // bytes per connection waiting for disk
+const uint32_t MAX_WRITE_QUEUE = 8388608;   // bytes across all connections waiting for disk
+const string RESUME_DIR = ".resume";
+
+// next connection ID handed out in a SYN-ACK
+int client_number = 1;
+uint64_t cookieKey[2];
+unordered_map<uint16_t,uint32_t> connToNextExpectedSeq;
+unordered_map<uint16_t,Header> connToLastInOrderACKSent;
+unordered_map<uint16_t,Options> connToOptions;
+unordered_map<uint16_t,sockaddr_in> connToClientAddr;
+unordered_map<uint16_t,uint32_t> connToDigest;
+unordered_map<uint64_t,uint16_t> tokenToConnection;
+
+// write-behind queue, shared with the writer thread
+mutex writeMutex;
+condition_variable writeCond;
+unordered_map<uint16_t,vector<char>> connToPendingWrite;
+unordered_map<uint16_t,uint32_t> connToQueuedBytes;
+deque<uint16_t> connsWithPendingWrites;
+uint32_t writeQueueBytes = 0;
+bool writerStopping = false;
+// connections told to stop and waiting for the writer to open the window again
+unordered_set<uint16_t> connsWithClosedWindow;
+deque<uint16_t> connsNeedingWindowUpdate;
+int windowUpdateFd = -1;
+// output file of each connection, and for resumable transfers the token and
+// the number of bytes the writer has put in the file
+unordered_map<uint16_t,int> connToFileNumber;
+unordered_map<uint16_t,uint64_t> connToResumeToken;
+unordered_map<uint16_t,uint64_t> connToBytesWritten;
+
+// reassembles the block stream of a compressed connection; only the writer
+// thread touches an entry once it exists
+struct BlockDecoder
+{
+  vector<char> pending;   // start of a block whose stored bytes are still arriving
+  bool failed;
+};
+unordered_map<uint16_t,BlockDecoder> connToDecoder;
+
+volatile sig_atomic_t stopRequested = 0;
+
+struct Arguments
+{
+  int port;
+  string fileDir;
+  int maxMSS;
+  long diskRate;
+};
+
+void printUsage()
+{
+  cerr<< "USAGE: ./server [-m MAX-MSS] [-w DISK-BYTES-PER-SEC] <PORT> <FILE-DIR>\n";
+}
+
+void printError(string message)
+{
+  cerr<<"ERROR: ";
+  cerr<< message <<endl;
+}
+
+void sigHandler(int n)
+{
+  if(n == SIGTERM || n == SIGQUIT)
+    {
+      // let the main loop stop and the writer drain its queue
+      stopRequested = 1;
+    }
+  else
+    {
+      printError("Signal "+to_string(n)+" received.");
+      exit(1);
+    }
+}
+
+
+long parsePort(char *arg)
+{
+  long temp_port = strtol(arg,nullptr,10);
+  if(temp_port == 0 || temp_port==LONG_MAX || temp_port==LONG_MIN || (temp_port<1024) || temp_port>65535)
+    {
+      printError("Port number needs to be a valid integer greater than 1023.");
+      exit(1);
+    }
+  return temp_port;
+}
+
+void exitOnError(int sockfd)
+{
+  close(sockfd);
+  exit(1);
+}
+
+void createDirIfNotExists(string path)
+{
+  struct stat s;
+
+  if(!(stat(path.c_str(), &s) == 0 &&S_ISDIR(s.st_mode)))
+    {
+      if(mkdir(path.c_str(), 0777)<0)
+        {
+	        printError("Unable to create directory.");
+	        exit(1);
+        }
+
+    }
+}
+
+int parseMSS(char *arg)
+{
+  long temp_mss = strtol(arg,nullptr,10);
+  if(temp_mss<1 || temp_mss>MAX_DATA_SIZE)
+    {
+      printError("MSS needs to be an integer between 1 and "+to_string(MAX_DATA_SIZE)+".");
+      exit(1);
+    }
+  return temp_mss;
+}
+
+long parseRate(char *arg)
+{
+  long temp_rate = strtol(arg,nullptr,10);
+  if(temp_rate<1 || temp_rate==LONG_MAX)
+    {
+      printError("Disk rate needs to be a positive number of bytes per second.");
+      exit(1);
+    }
+  return temp_rate;
+}
+
+Arguments parseArguments(int argc, char**argv)
+{
+  Arguments args;
+  args.maxMSS = MAX_DATA_SIZE;
+  args.diskRate = 0;
+
+  int opt;
+  while((opt = getopt(argc, argv, "m:w:")) != -1)
+    {
+      switch(opt)
+        {
+        case 'm':
+          args.maxMSS = parseMSS(optarg);
+          break;
+        case 'w':
+          // throttles the writer thread, to exercise flow control
+          args.diskRate = parseRate(optarg);
+          break;
+        default:
+          printUsage();
+          exit(1);
+        }
+    }
+
+  if(argc-optind!=NUMBER_OF_ARGS)
+    {
+      printError("Incorrect number of arguments");
+      printUsage();
+      exit(1);
+    }
+
+  // port
+  args.port = parsePort(argv[optind]);
+
+  // directory
+  createDirIfNotExists(string(argv[optind+1]));
+  args.fileDir = (string) argv[optind+1];
+
+  return args;
+}
+
+void setReuse(const int sockfd)
+{
+  // allow others to reuse the address
+  int yes = 1;
+  if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int)) == -1) {
+    printError("setsockopt() failed.");
+    exitOnError(sockfd);
+  }
+}
+
+bool hasNoFlags(Header packet_header)
+{
+  return !packet_header.FINflag&&!packet_header.ACKflag&&!packet_header.SYNflag;
+}
+
+
+struct sockaddr_in createServerAddr(const int sockfd, const int port)
+{
+  // bind address to socket
+  struct sockaddr_in addr;
+  memset((char *)&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);     // short, network byte order
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  return addr;
+}
+
+void bindSocket(const int sockfd, const sockaddr_in addr)
+{
+  if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) <0)
+    {
+      printError("bind() failed.");
+      exitOnError(sockfd);
+    }
+}
+
+string getFileName(string fileDir, int num)
+{
+  return fileDir +"/" + to_string(num) + ".file";
+}
+
+string getResumeFileName(string fileDir, uint64_t token)
+{
+  char name[17];
+  snprintf(name, sizeof(name), "%016llx", (unsigned long long)token);
+  return fileDir + "/" + RESUME_DIR + "/" + name;
+}
+
+// A resumable transfer has a sidecar file in RESUME_DIR, named after its
+// token, holding the number of its output file and how much of it is written.
+struct ResumeRecord
+{
+  int fileNumber;
+  uint64_t offset;
+};
+
+bool readResumeRecord(string fileDir, uint64_t token, ResumeRecord &record)
+{
+  fstream fin;
+  fin.open(getResumeFileName(fileDir,token), ios::in);
+  if(!(fin>>record.fileNumber>>record.offset))
+    return false;
+
+  // anything recorded but missing from the file is simply sent again
+  struct stat s;
+  if(stat(getFileName(fileDir,record.fileNumber).c_str(), &s)!=0)
+    return false;
+  record.offset = min(record.offset, (uint64_t)s.st_size);
+  return true;
+}
+
+// rewrites the fixed width record in place with a single pwrite()
+void writeResumeRecord(string fileDir, uint64_t token, ResumeRecord record)
+{
+  char line[40];
+  int len = snprintf(line, sizeof(line), "%10d %20llu\n", record.fileNumber, (unsigned long long)record.offset);
+  int fd = open(getResumeFileName(fileDir,token).c_str(), O_WRONLY|O_CREAT, 0644);
+  if(fd<0 || pwrite(fd, line, len, 0)!=len)
+  {
+    printError("Unable to update resume record.");
+  }
+  if(fd>=0)
+    close(fd);
+}
+
+void initCookieKey()
+{
+  int fd = open("/dev/urandom", O_RDONLY);
+  if(fd<0 || read(fd, cookieKey, sizeof(cookieKey))!=sizeof(cookieKey))
+    {
+      printError("Unable to read /dev/urandom.");
+      exit(1);
+    }
+  close(fd);
+}
+
+inline uint64_t rotl64(uint64_t x, int b)
+{
+  return (x<<b)|(x>>(64-b));
+}
+
+inline void sipRound(uint64_t &v0, uint64_t &v1, uint64_t &v2, uint64_t &v3)
+{
+  v0 += v1; v1 = rotl64(v1,13); v1 ^= v0; v0 = rotl64(v0,32);
+  v2 += v3; v3 = rotl64(v3,16); v3 ^= v2;
+  v0 += v3; v3 = rotl64(v3,21); v3 ^= v0;
+  v2 += v1; v1 = rotl64(v1,17); v1 ^= v2; v2 = rotl64(v2,32);
+}
+
+// SipHash-2-4 over whole 64-bit words
+uint64_t sipHash(const uint64_t key[2], const uint64_t *words, int count)
+{
+  uint64_t v0 = key[0]^0x736f6d6570736575ULL;
+  uint64_t v1 = key[1]^0x646f72616e646f6dULL;
+  uint64_t v2 = key[0]^0x6c7967656e657261ULL;
+  uint64_t v3 = key[1]^0x7465646279746573ULL;
+  for(int i = 0; i<count; i++)
+  {
+    v3 ^= words[i];
+    sipRound(v0,v1,v2,v3);
+    sipRound(v0,v1,v2,v3);
+    v0 ^= words[i];
+  }
+  uint64_t last = ((uint64_t)(count*8))<<56;
+  v3 ^= last;
+  sipRound(v0,v1,v2,v3);
+  sipRound(v0,v1,v2,v3);
+  v0 ^= last;
+  v2 ^= 0xff;
+  for(int i = 0; i<4; i++)
+    sipRound(v0,v1,v2,v3);
+  return v0^v1^v2^v3;
+}
+
+uint64_t currentCookieSlot()
+{
+  return time(nullptr)/COOKIE_SLOT_SECONDS;
+}
+
+// The SYN-ACK sequence number is a keyed hash of everything the server would
+// otherwise have to remember between the SYN and the final ACK.
+uint32_t createCookie(const sockaddr_in &clientAddr, uint32_t clientSeq, uint16_t connectionID, Options grantedOptions, uint64_t slot)
+{
+  uint64_t words[5];
+  words[0] = ((uint64_t)clientAddr.sin_addr.s_addr<<16)|clientAddr.sin_port;
+  words[1] = ((uint64_t)clientSeq<<16)|connectionID;
+  words[2] = (slot<<24)|((uint64_t)grantedOptions.hasCompress<<19)|((uint64_t)grantedOptions.hasCRC<<18)|((uint64_t)grantedOptions.hasResume<<17)|((uint64_t)grantedOptions.hasRwnd<<16)|grantedOptions.mss;
+  words[3] = grantedOptions.resumeToken;
+  words[4] = grantedOptions.resumeOffset;
+  return sipHash(cookieKey, words, 5)%(MAX_SEQACK+1);
+}
+
+// after a restart, numbering continues past the files already in fileDir so
+// neither finished nor resumable transfers are overwritten
+void initConnectionNumber(string fileDir)
+{
+  DIR *dir = opendir(fileDir.c_str());
+  if(!dir)
+    return;
+  struct dirent *entry;
+  while((entry = readdir(dir)))
+  {
+    int num;
+    char suffix[6];
+    if(sscanf(entry->d_name, "%d.%5s", &num, suffix)==2 && string(suffix)=="file" && num>=client_number && num<MAX_CONNECTION_ID)
+    {
+      client_number = num+1;
+    }
+  }
+  closedir(dir);
+}
+
+// hands out connection IDs round robin, skipping those that are still live
+uint16_t nextConnectionID()
+{
+  for(int i = 0; i<MAX_CONNECTION_ID; i++)
+  {
+    uint16_t id = client_number;
+    client_number = client_number%MAX_CONNECTION_ID+1;
+    if(!connToNextExpectedSeq.count(id))
+      return id;
+  }
+  return 0;
+}
+
+// creates the SYNACK for the 3-way handshake
+Header createSYNACK(Header clientSyn, uint16_t connectionID, uint32_t cookie)
+{
+  Header serverSynAck;
+  serverSynAck.ACKflag = 1;
+  serverSynAck.connectionID = connectionID;
+  serverSynAck.SYNflag = 1;
+  serverSynAck.FINflag = 0;
+  serverSynAck.OPTflag = clientSyn.OPTflag;
+  serverSynAck.sequenceNumber = cookie;
+  serverSynAck.acknowledgementNumber = clientSyn.sequenceNumber+1;
+  return serverSynAck;
+}
+
+// grants the client's requested MSS, capped at the server's maximum, agrees
+// to advertise a receive window if the client asked for one, and tells a
+// resuming client how much of its file is already here
+Options createSYNACKOptions(Options clientOptions, int maxMSS, string fileDir)
+{
+  Options serverOptions = noOptions();
+  if(clientOptions.mss)
+  {
+    serverOptions.mss = min((int)clientOptions.mss, maxMSS);
+  }
+  if(clientOptions.hasRwnd)
+  {
+    serverOptions.hasRwnd = true;
+    serverOptions.rwnd = RECV_BUFFER_SIZE;
+  }
+  serverOptions.hasCRC = clientOptions.hasCRC;
+  serverOptions.hasCompress = clientOptions.hasCompress;
+  if(clientOptions.hasResume)
+  {
+    ResumeRecord record;
+    serverOptions.hasResume = true;
+    serverOptions.resumeToken = clientOptions.resumeToken;
+    serverOptions.resumeOffset = readResumeRecord(fileDir, clientOptions.resumeToken, record) ? record.offset : 0;
+  }
+  return serverOptions;
+}
+
+Options getOptions(uint16_t connectionID)
+{
+  auto it = connToOptions.find(connectionID);
+  return it==connToOptions.end() ? noOptions() : it->second;
+}
+
+int getMSS(uint16_t connectionID)
+{
+  Options o = getOptions(connectionID);
+  return o.mss ? o.mss : DATA_SIZE;
+}
+
+// free space in the connection's write-behind buffer, bounded by what is
+// left of the shared write queue; writeMutex must be held
+uint32_t freeWindow(uint16_t connectionID)
+{
+  auto it = connToQueuedBytes.find(connectionID);
+  uint32_t queued = it==connToQueuedBytes.end() ? 0 : it->second;
+  return min(RECV_BUFFER_SIZE-queued, MAX_WRITE_QUEUE-writeQueueBytes);
+}
+
+uint32_t advertisedWindow(uint16_t connectionID)
+{
+  lock_guard<mutex> lock(writeMutex);
+  return freeWindow(connectionID);
+}
+
+// attaches the current receive window to an ACK if the client negotiated it;
+// a window too small for a full segment is reopened by a window update
+void addWindowOption(Header &response, Options &response_options)
+{
+  if(!getOptions(response.connectionID).hasRwnd)
+    return;
+  response.OPTflag = 1;
+  response_options.hasRwnd = true;
+
+  lock_guard<mutex> lock(writeMutex);
+  response_options.rwnd = freeWindow(response.connectionID);
+  if(response_options.rwnd<(uint32_t)getMSS(response.connectionID))
+  {
+    connsWithClosedWindow.insert(response.connectionID);
+  }
+}
+
+bool beginNewConnection(Header packet)
+{
+  return packet.SYNflag&&!packet.ACKflag&&!packet.FINflag&&(packet.connectionID==0);
+}
+
+bool outOfOrder(Header packet_header)
+{
+  if(beginNewConnection(packet_header))
+    return false;
+  auto it = connToLastInOrderACKSent.find(packet_header.connectionID);
+  return it!=connToLastInOrderACKSent.end() && it->second.acknowledgementNumber != packet_header.sequenceNumber;
+}
+
+Header createACKHandshake(Header client, uint32_t payloadSize)
+{
+  Header serverACK;
+  serverACK.SYNflag = 0;
+  serverACK.FINflag = 0;
+  serverACK.ACKflag = 1;
+  serverACK.OPTflag = 0;
+
+  serverACK.connectionID = client.connectionID;
+  serverACK.acknowledgementNumber = client.sequenceNumber;
+
+  if(hasNoFlags(client))
+  {
+    serverACK.sequenceNumber = connToLastInOrderACKSent[client.connectionID].sequenceNumber;
+  }
+  else
+  {
+    serverACK.sequenceNumber = client.acknowledgementNumber;
+  }
+
+  if(payloadSize>0)
+  {
+    serverACK.acknowledgementNumber+=payloadSize;
+  }
+  else if(client.SYNflag)
+  {
+    serverACK.acknowledgementNumber++;
+  }
+
+  if(serverACK.acknowledgementNumber>MAX_SEQACK)
+  {
+    serverACK.acknowledgementNumber = serverACK.acknowledgementNumber% (MAX_SEQACK + 1);// + payloadSize;
+  }
+  if(serverACK.sequenceNumber>MAX_SEQACK)
+  {
+    serverACK.sequenceNumber = serverACK.sequenceNumber% (MAX_SEQACK + 1);
+  }
+
+
+  return serverACK;
+}
+
+bool receivedACK(Header packet)
+{
+  return packet.ACKflag&&!packet.FINflag&&!packet.SYNflag;
+}
+
+enum msgType{RECV,SEND,DROP};
+
+void printPacketDetails(Header packet_header, msgType type, bool dup=false)
+{
+  if(type==DROP)
+    cout<<"DROP ";
+  else if(type==RECV)
+    cout<<"RECV ";
+  else
+    cout<<"SEND ";
+
+  cout<<packet_header.sequenceNumber<<" "<<packet_header.acknowledgementNumber<<" "<<packet_header.connectionID;
+
+  if(packet_header.ACKflag)
+    cout<<" "<<"ACK";
+  if(packet_header.SYNflag)
+    cout<<" "<<"SYN";
+  if(packet_header.FINflag)
+    cout<<" "<<"FIN";
+  if(type==SEND && dup)
+    cout<<" DUP";
+
+  cout<<endl;
+}
+
+void createNewFile(int num, string fileDir)
+{
+  fstream fout;
+  fout.open(getFileName(fileDir,num), ios::out);
+  fout.close();
+}
+
+void writePayloadToFile(int num, string fileDir, char * payload, int size)
+{
+  fstream fout;
+  fout.open(getFileName(fileDir,num), ios::app);
+  fout.write(payload, size);
+  fout.close();
+}
+
+// hands the payload to the writer thread; the bytes count against the
+// advertised window until they are on their way to disk
+void queuePayloadForFile(uint16_t connectionID, char *payload, int size)
+{
+  if(size<=0)
+    return;
+  lock_guard<mutex> lock(writeMutex);
+  vector<char> &pending = connToPendingWrite[connectionID];
+  if(pending.empty())
+  {
+    connsWithPendingWrites.push_back(connectionID);
+  }
+  pending.insert(pending.end(), payload, payload+size);
+  connToQueuedBytes[connectionID] += size;
+  writeQueueBytes += size;
+  writeCond.notify_one();
+}
+
+// Appends the raw bytes of every complete block in data to out and keeps the
+// rest for the next call. Returns false if the stream is malformed.
+bool decodeBlocks(BlockDecoder &decoder, const vector<char> &data, vector<char> &out)
+{
+  vector<char> &pending = decoder.pending;
+  pending.insert(pending.end(), data.begin(), data.end());
+  size_t pos = 0;
+  while(pending.size()-pos>=(size_t)BLOCK_HEADER_SIZE)
+  {
+    uint32_t rawLen, storedLen;
+    bool compressed;
+    getBlockHeader(pending.data()+pos, rawLen, storedLen, compressed);
+    if(rawLen>(uint32_t)COMPRESS_BLOCK_SIZE || storedLen>(uint32_t)COMPRESS_BLOCK_SIZE || (!compressed && storedLen!=rawLen))
+      return false;
+    if(pending.size()-pos<BLOCK_HEADER_SIZE+storedLen)
+      break;
+
+    const char *stored = pending.data()+pos+BLOCK_HEADER_SIZE;
+    size_t outPos = out.size();
+    out.resize(outPos+rawLen);
+    if(!compressed)
+      memcpy(out.data()+outPos, stored, rawLen);
+    else if(lzDecompress(stored, storedLen, out.data()+outPos, rawLen)!=(int)rawLen)
+      return false;
+    pos += BLOCK_HEADER_SIZE+storedLen;
+  }
+  pending.erase(pending.begin(), pending.begin()+pos);
+  return true;
+}
+
+// drains the write-behind queue one connection at a time until asked to stop
+void writerLoop(string fileDir, long diskRate)
+{
+  vector<char> chunk;
+  vector<char> decoded;
+  unique_lock<mutex> lock(writeMutex);
+  while(true)
+  {
+    writeCond.wait(lock, []{ return writerStopping || !connsWithPendingWrites.empty(); });
+    if(connsWithPendingWrites.empty())
+      break;
+
+    uint16_t connectionID = connsWithPendingWrites.front();
+    connsWithPendingWrites.pop_front();
+    chunk.swap(connToPendingWrite[connectionID]);
+    int fileNumber = connToFileNumber[connectionID];
+    auto it = connToResumeToken.find(connectionID);
+    bool resumable = it!=connToResumeToken.end();
+    uint64_t token = resumable ? it->second : 0;
+    auto decoderIt = connToDecoder.find(connectionID);
+    BlockDecoder *decoder = decoderIt==connToDecoder.end() ? nullptr : &decoderIt->second;
+    lock.unlock();
+
+    // a compressed stream reaches the file one whole block at a time
+    vector<char> *raw = &chunk;
+    if(decoder)
+    {
+      decoded.clear();
+      if(!decoder->failed && !decodeBlocks(*decoder, chunk, decoded))
+      {
+        decoder->failed = true;
+        printError("Malformed compressed data on connection "+to_string(connectionID)+".");
+      }
+      raw = &decoded;
+    }
+    ResumeRecord record;
+    if(resumable)
+    {
+      lock.lock();
+      record.fileNumber = fileNumber;
+      record.offset = connToBytesWritten[connectionID] += raw->size();
+      lock.unlock();
+    }
+
+    if(!raw->empty())
+    {
+      writePayloadToFile(fileNumber, fileDir, raw->data(), raw->size());
+    }
+    // the record only ever covers bytes that are already in the file
+    if(resumable)
+    {
+      writeResumeRecord(fileDir, token, record);
+    }
+    if(diskRate)
+    {
+      this_thread::sleep_for(chrono::microseconds(raw->size()*1000000/diskRate));
+    }
+
+    lock.lock();
+    connToQueuedBytes[connectionID] -= chunk.size();
+    writeQueueBytes -= chunk.size();
+    chunk.clear();
+
+    // wake the main loop once at least half the buffer is free again
+    if(connsWithClosedWindow.count(connectionID) && freeWindow(connectionID)>=RECV_BUFFER_SIZE/2)
+    {
+      connsWithClosedWindow.erase(connectionID);
+      connsNeedingWindowUpdate.push_back(connectionID);
+      uint64_t one = 1;
+      if(write(windowUpdateFd, &one, sizeof(one))<0)
+      {
+        printError("Unable to signal window update");
+      }
+    }
+  }
+}
+
+// resends the last in-order ACK, now carrying the reopened window
+void sendWindowUpdates(int clientSockfd)
+{
+  uint64_t count;
+  if(read(windowUpdateFd, &count, sizeof(count))<0)
+    return;
+
+  deque<uint16_t> updates;
+  {
+    lock_guard<mutex> lock(writeMutex);
+    updates.swap(connsNeedingWindowUpdate);
+  }
+  for(uint16_t connectionID : updates)
+  {
+    auto it = connToLastInOrderACKSent.find(connectionID);
+    if(it==connToLastInOrderACKSent.end())
+      continue;
+    Header response = it->second;
+    Options response_options = noOptions();
+    char responsePacket[HEADER_SIZE+MAX_OPTIONS_SIZE];
+    addWindowOption(response, response_options);
+    int responseSize = buildPacket(response,response_options,nullptr,0,responsePacket);
+    const sockaddr_in &clientAddr = connToClientAddr[connectionID];
+    if (sendto(clientSockfd, responsePacket, responseSize, 0, (const sockaddr *)&clientAddr, sizeof(clientAddr)) == -1)
+    {
+      printError("Unable to send data to server");
+      exitOnError(clientSockfd);
+    }
+    printPacketDetails(response,SEND,true);
+  }
+}
+
+void stopWriter(thread &writer)
+{
+  {
+    lock_guard<mutex> lock(writeMutex);
+    writerStopping = true;
+  }
+  writeCond.notify_one();
+  writer.join();
+}
+
+bool receivedFIN(Header packet_header)
+{
+  return !packet_header.SYNflag&&packet_header.FINflag&&!packet_header.ACKflag;
+}
+
+Header createFINACK(Header packet_header)
+{
+  Header serverFINACK;
+  serverFINACK.ACKflag = 1;
+  serverFINACK.SYNflag = 0;
+  serverFINACK.FINflag = 1;
+  serverFINACK.OPTflag = 0;
+
+  serverFINACK.sequenceNumber = connToLastInOrderACKSent[packet_header.connectionID].sequenceNumber;
+
+  serverFINACK.connectionID = packet_header.connectionID;
+  serverFINACK.acknowledgementNumber = packet_header.sequenceNumber+1;
+
+
+  if(serverFINACK.acknowledgementNumber>MAX_SEQACK)
+  {
+    serverFINACK.acknowledgementNumber = serverFINACK.acknowledgementNumber % (MAX_SEQACK + 1);
+  }
+  if(serverFINACK.sequenceNumber>MAX_SEQACK)
+  {
+    serverFINACK.sequenceNumber = serverFINACK.sequenceNumber % (MAX_SEQACK + 1);
+  }
+
+  return serverFINACK;
+}
+
+bool isValidConnectionStart(Header packet_header)
+{
+  return (beginNewConnection(packet_header)&&packet_header.acknowledgementNumber == 0 && packet_header.sequenceNumber == 12345);
+}
+
+bool isKnownConnection(uint16_t connectionID)
+{
+  return connToNextExpectedSeq.count(connectionID);
+}
+
+// a final handshake ACK for a connection that only exists as a cookie
+bool isCookieACK(Header packet_header)
+{
+  return receivedACK(packet_header) && packet_header.connectionID>0 && !isKnownConnection(packet_header.connectionID);
+}
+
+// drops the server's state for a connection whose client has gone away
+void forgetConnection(uint16_t connectionID)
+{
+  connToDigest.erase(connectionID);
+  connToNextExpectedSeq.erase(connectionID);
+  connToLastInOrderACKSent.erase(connectionID);
+  connToOptions.erase(connectionID);
+  connToClientAddr.erase(connectionID);
+
+  lock_guard<mutex> lock(writeMutex);
+  connToResumeToken.erase(connectionID);
+}
+
+// Picks up the file a token was writing to, cut back to the offset the client
+// was promised in the SYN-ACK, or starts a new one. A connection still holding
+// the token belongs to a client that gave up, so it is dropped. Returns the
+// file number, or -1 if the promised offset can no longer be honoured.
+int startResumableTransfer(uint16_t connectionID, Options ackOptions, string fileDir)
+{
+  uint64_t token = ackOptions.resumeToken;
+  ResumeRecord record;
+  bool found = readResumeRecord(fileDir, token, record);
+  if(ackOptions.resumeOffset>0 && (!found || record.offset<ackOptions.resumeOffset))
+    return -1;
+
+  auto previous = tokenToConnection.find(token);
+  if(previous!=tokenToConnection.end() && previous->second!=connectionID)
+  {
+    forgetConnection(previous->second);
+  }
+  tokenToConnection[token] = connectionID;
+
+  createDirIfNotExists(fileDir+"/"+RESUME_DIR);
+  if(found)
+  {
+    if(truncate(getFileName(fileDir,record.fileNumber).c_str(), ackOptions.resumeOffset)<0)
+      return -1;
+    record.offset = ackOptions.resumeOffset;
+  }
+  else
+  {
+    record.fileNumber = connectionID;
+    record.offset = 0;
+    createNewFile(connectionID,fileDir);
+  }
+  writeResumeRecord(fileDir, token, record);
+
+  lock_guard<mutex> lock(writeMutex);
+  connToResumeToken[connectionID] = token;
+  connToBytesWritten[connectionID] = record.offset;
+  return record.fileNumber;
+}
+
+// Checks the echoed cookie against the current and the previous slot. On
+// success the connection state and its file are created, as if the SYN-ACK
+// had been remembered.
+bool establishFromCookie(Header ack, Options ackOptions, const sockaddr_in &clientAddr, string fileDir)
+{
+  uint32_t clientSeq = (ack.sequenceNumber+MAX_SEQACK)%(MAX_SEQACK+1);
+  uint32_t cookie = (ack.acknowledgementNumber+MAX_SEQACK)%(MAX_SEQACK+1);
+  uint64_t slot = currentCookieSlot();
+  if(cookie!=createCookie(clientAddr, clientSeq, ack.connectionID, ackOptions, slot) &&
+     cookie!=createCookie(clientAddr, clientSeq, ack.connectionID, ackOptions, slot-1))
+  {
+    return false;
+  }
+
+  int fileNumber = ack.connectionID;
+  if(ackOptions.hasResume)
+  {
+    fileNumber = startResumableTransfer(ack.connectionID, ackOptions, fileDir);
+    if(fileNumber<0)
+      return false;
+  }
+  else
+  {
+    createNewFile(ack.connectionID,fileDir);
+  }
+  {
+    lock_guard<mutex> lock(writeMutex);
+    connToFileNumber[ack.connectionID] = fileNumber;
+    connToDecoder.erase(ack.connectionID);
+    if(ackOptions.hasCompress)
+    {
+      connToDecoder[ack.connectionID] = BlockDecoder();
+    }
+  }
+
+  Header clientSyn;
+  clientSyn.sequenceNumber = clientSeq;
+  clientSyn.OPTflag = ack.OPTflag;
+  Header synAck = createSYNACK(clientSyn, ack.connectionID, cookie);
+  connToOptions[ack.connectionID] = ackOptions;
+  connToClientAddr[ack.connectionID] = clientAddr;
+  connToNextExpectedSeq[ack.connectionID] = synAck.acknowledgementNumber;
+  connToLastInOrderACKSent[ack.connectionID] = synAck;
+  return true;
+}
+
+// with CRC negotiated every client packet after the SYN carries a trailer,
+// including the final handshake ACK whose echoed options say so
+bool expectsTrailer(Header packet_header, Options packet_options)
+{
+  if(isKnownConnection(packet_header.connectionID))
+    return getOptions(packet_header.connectionID).hasCRC;
+  return isCookieACK(packet_header) && packet_options.hasCRC;
+}
+
+// a FIN whose digest does not match the bytes received is not acknowledged
+bool digestMismatch(Header packet_header, Options packet_options)
+{
+  if(!receivedFIN(packet_header) || !packet_options.hasDigest || !getOptions(packet_header.connectionID).hasCRC)
+    return false;
+  if(packet_options.digest==connToDigest[packet_header.connectionID])
+    return false;
+  printError("File digest mismatch on connection "+to_string(packet_header.connectionID)+".");
+  return true;
+}
+
+// in-order data the write-behind buffer has no room for is dropped like an
+// out of order segment; the duplicate ACK tells the client the current window
+bool exceedsWindow(Header packet_header, int payloadSize)
+{
+  return payloadSize>0 && isKnownConnection(packet_header.connectionID) && (uint32_t)payloadSize>advertisedWindow(packet_header.connectionID);
+}
+
+bool isValidPacket(Header packet_header)
+{
+  return (isKnownConnection(packet_header.connectionID) && (packet_header.connectionID>0)&&(packet_header.sequenceNumber<=MAX_SEQACK)&&(packet_header.acknowledgementNumber<=MAX_SEQACK))|| isValidConnectionStart(packet_header);
+}
+
+void listenForPackets(int clientSockfd, string fileDir, int maxMSS)
+{
+  // read/write data from/into the connection
+  bool isEnd = false;
+  bool dup = false;
+  char buf[MAX_PACKET_SIZE] = {0};
+  struct pollfd fds[2];
+  fds[0].fd = clientSockfd;
+  fds[0].events = POLLIN;
+  fds[1].fd = windowUpdateFd;
+  fds[1].events = POLLIN;
+
+  while (!isEnd && !stopRequested)
+    {
+      struct sockaddr_in clientAddr;
+      socklen_t clientAddrSize = sizeof(clientAddr);
+      dup = false;
+
+      int rec_res = recvfrom(clientSockfd, buf, MAX_PACKET_SIZE, 0, (struct sockaddr *)&clientAddr,&clientAddrSize);
+
+      if (rec_res == -1 && (errno==EWOULDBLOCK || errno==EINTR))
+        {
+          // nothing to read: block until a datagram or a window update
+          // arrives instead of spinning
+          if(poll(fds, 2, POLL_TIMEOUT_MSECS)>0 && fds[1].revents)
+          {
+            sendWindowUpdates(clientSockfd);
+          }
+          continue;
+        }
+      else if (rec_res == -1)
+        {
+	        printError("Error in receiving data");
+          exitOnError(clientSockfd);
+        }
+      else if(!rec_res)
+        {
+          break;
+        }
+      if(rec_res > 0)
+      {
+        Header packet_header;
+        Options packet_options;
+        int payloadOffset = parsePacket(buf, rec_res, packet_header, packet_options);
+        if(payloadOffset<0)
+        {
+          continue;
+        }
+        // corrupted packets are dropped before anything else looks at them
+        if(expectsTrailer(packet_header, packet_options) && !stripTrailer(buf, rec_res))
+        {
+          printPacketDetails(packet_header,DROP);
+          continue;
+        }
+        int payloadSize = rec_res-payloadOffset;
+        Header response;
+        Options response_options = noOptions();
+        char responsePacket[HEADER_SIZE+MAX_OPTIONS_SIZE];
+
+        // the final ACK of a handshake must carry a valid cookie
+        if(isCookieACK(packet_header) && !establishFromCookie(packet_header, packet_options, clientAddr, fileDir))
+        {
+          printPacketDetails(packet_header,DROP);
+          continue;
+        }
+
+        // print details
+        if(outOfOrder(packet_header) || exceedsWindow(packet_header, payloadSize))
+        {
+          response = connToLastInOrderACKSent[packet_header.connectionID];
+          dup = true;
+          printPacketDetails(packet_header,DROP);
+        }
+        else if(!isValidPacket(packet_header) || payloadSize>getMSS(packet_header.connectionID) || digestMismatch(packet_header, packet_options))
+        {
+          printPacketDetails(packet_header,DROP);
+          continue;
+        }
+        else if(!outOfOrder(packet_header))
+        {
+          printPacketDetails(packet_header,RECV);
+          // if SYN then answer with a cookie; no state is kept until the final ACK
+          if (beginNewConnection(packet_header))
+          {
+            uint16_t connectionID = nextConnectionID();
+            response_options = createSYNACKOptions(packet_options, maxMSS, fileDir);
+            uint32_t cookie = createCookie(clientAddr, packet_header.sequenceNumber, connectionID, response_options, currentCookieSlot());
+            response = createSYNACK(packet_header, connectionID, cookie);
+          }
+          else if((receivedACK(packet_header)||hasNoFlags(packet_header)))
+          {
+            response = createACKHandshake(packet_header, payloadSize);
+            connToLastInOrderACKSent[packet_header.connectionID] = response;
+            connToNextExpectedSeq[packet_header.connectionID] = response.acknowledgementNumber;
+            // write to file
+            if(getOptions(packet_header.connectionID).hasCRC)
+            {
+              connToDigest[packet_header.connectionID] = crc32c(connToDigest[packet_header.connectionID], buf+payloadOffset, payloadSize);
+            }
+            queuePayloadForFile(packet_header.connectionID,buf+payloadOffset, payloadSize);
+          }
+          else if(receivedFIN(packet_header))
+          {
+            response = createFINACK(packet_header);
+            connToLastInOrderACKSent[packet_header.connectionID] = response;
+            connToNextExpectedSeq[packet_header.connectionID] = response.acknowledgementNumber;
+          }
+        }
+        if(!response.SYNflag)
+        {
+          addWindowOption(response, response_options);
+        }
+        int responseSize = buildPacket(response,response_options,nullptr,0,responsePacket);
+
+        if(!receivedACK(packet_header) && isValidPacket(packet_header))
+        {
+          if (sendto(clientSockfd, responsePacket, responseSize, 0, (const sockaddr *)&clientAddr, clientAddrSize) == -1)
+          {
+            printError("Unable to send data to server");
+            exitOnError(clientSockfd);
+          }
+          printPacketDetails(response,SEND,dup);
+        }
+      }
+
+    }
+}
+
+void setupEnvironment(const int sockfd)
+{
+  int flags = fcntl(sockfd, F_GETFL, 0);
+  if(flags<0)
+    {
+      printError("fcntl() failed");
+      exit(1);
+    }
+  if(fcntl(sockfd,F_SETFL,flags|O_NONBLOCK)<0)
+    {
+      printError("fcntl() failed.");
+      exit(1);
+    }
+}
+
+void worker(int clientSockfd, int n, string fileDir, int maxMSS)
+{
+  setupEnvironment(clientSockfd);
+  listenForPackets(clientSockfd, fileDir, maxMSS);
+  close(clientSockfd);
+}
+
+int main(int argc, char **argv)
+{
+  Arguments args = parseArguments(argc, argv);
+  initCookieKey();
+  initConnectionNumber(args.fileDir);
+
+  signal(SIGTERM, sigHandler);
+  signal(SIGQUIT, sigHandler);
+
+  // create a socket using UDP IP
+  int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+
+  if(sockfd < 0)
+  {
+    printError("fcntl() failed");
+    exit(1);
+  }
+
+  setReuse(sockfd);
+  setupEnvironment(sockfd);
+
+  struct sockaddr_in addr = createServerAddr(sockfd, args.port);
+
+  bindSocket(sockfd, addr);
+
+  windowUpdateFd = eventfd(0, EFD_NONBLOCK);
+  if(windowUpdateFd<0)
+  {
+    printError("eventfd() failed");
+    exit(1);
+  }
+  thread writer(writerLoop, args.fileDir, args.diskRate);
+
+  // set socket to listen status
+  while (!stopRequested)
+    {
+      worker(sockfd,client_number,args.fileDir,args.maxMSS);
+    }
+  stopWriter(writer);
+  close(sockfd);
+
+  return 0;
 }
\ No newline at end of file